@@ -0,0 +1,78 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "SysTime.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/*
+ * Helpers shared by the benchmark programs.
+ *
+ * Timings use SysTime::getTickCountNs(). Results are printed one line
+ * per case, so runs before and after a change can be diffed.
+ */
+class Bench
+{
+public:
+    /*
+     * Runs op() in rounds of batch calls until minMs have passed.
+     * @return nanoseconds per call.
+     */
+    template <typename F>
+    static double measure(F&& op, uint32_t minMs = 200, uint64_t batch = 1024)
+    {
+        const uint64_t start = SysTime::getTickCountNs();
+        const uint64_t until = start + static_cast<uint64_t>(minMs) * 1000 * 1000;
+
+        uint64_t calls = 0;
+        uint64_t now = start;
+
+        do
+        {
+            for (uint64_t i = 0; i < batch; ++i)
+                op();
+
+            calls += batch;
+            now = SysTime::getTickCountNs();
+        } while (now < until);
+
+        return static_cast<double>(now - start) / static_cast<double>(calls);
+    }
+
+    static void header(const char* title)
+    {
+        printf("\n== %s\n", title);
+    }
+
+    static void report(const char* name, double nsPerOp)
+    {
+        printf("  %-44s %10.1f ns/op %10.2f M/s\n", name, nsPerOp, 1000.0 / nsPerOp);
+    }
+
+    static void reportRate(const char* name, uint64_t count, uint64_t ns)
+    {
+        report(name, static_cast<double>(ns) / static_cast<double>(count));
+    }
+
+    /*
+     * Percentile of samples (sorted in place), 0 <= p <= 100.
+     */
+    static uint64_t percentile(std::vector<uint64_t>& samples, double p)
+    {
+        if (samples.empty())
+            return 0;
+
+        std::sort(samples.begin(), samples.end());
+
+        const size_t index = static_cast<size_t>(p / 100.0 * static_cast<double>(samples.size() - 1));
+        return samples[index];
+    }
+};
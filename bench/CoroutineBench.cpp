@@ -0,0 +1,152 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "Bench.h"
+
+#include "Coroutine.h"
+
+#include <atomic>
+#include <thread>
+
+/*
+ * Coroutine.h costs. Built with -std=c++20 (see Makefile), so this is
+ * also the compile check for the header.
+ *
+ * - Task create + run + free, from the frame pool
+ * - a 100k-deep await chain (symmetric transfer)
+ * - sleepFor(0) and switchTo() round trips on a running loop
+ * - check: a frame destroyed by an earlier callback of the same expiry
+ *   batch is not resumed
+ */
+#if !HAVE_COROUTINES
+#error "Coroutine.h needs a C++20 compiler with <coroutine>"
+#endif
+
+namespace
+{
+Task<int> leaf(int value)
+{
+    co_return value;
+}
+
+Task<void> sum(int& total)
+{
+    total += co_await leaf(1);
+}
+
+Task<int> chain(int depth)
+{
+    if (depth == 0)
+        co_return 0;
+
+    co_return 1 + co_await chain(depth - 1);
+}
+
+Task<void> deepChain(int depth, int& result)
+{
+    result = co_await chain(depth);
+}
+
+Task<void> sleeper(MainLoop& loop, int count, std::atomic<bool>& done)
+{
+    for (int i = 0; i < count; ++i)
+        co_await loop.sleepFor(0);
+
+    done.store(true);
+}
+
+Task<void> switcher(MainLoop& loop, int count, std::atomic<bool>& done)
+{
+    for (int i = 0; i < count; ++i)
+        co_await loop.switchTo();
+
+    done.store(true);
+}
+
+Task<void> victim(MainLoop& loop, bool& resumed)
+{
+    co_await loop.sleepFor(2);
+    resumed = true;
+}
+
+/*
+ * Runs task until its first suspension, keeping ownership.
+ */
+void startOwned(Task<void>& task)
+{
+    std::move(task).operator co_await().await_suspend(std::noop_coroutine()).resume();
+}
+
+void benchLoopResume(const char* name, Task<void> (*body)(MainLoop&, int, std::atomic<bool>&))
+{
+    constexpr int Count = 200 * 1000;
+
+    MainLoop loop;
+    std::atomic<bool> done(false);
+
+    std::thread thread([&loop]() { loop.loop(); });
+
+    const uint64_t start = SysTime::getTickCountNs();
+
+    loop.post([&loop, &done, body]() { body(loop, Count, done).detach(); });
+
+    while (!done.load())
+        std::this_thread::yield();
+
+    Bench::reportRate(name, Count, SysTime::getTickCountNs() - start);
+
+    loop.terminate();
+    thread.join();
+}
+
+void checkSameBatchDestroy()
+{
+    MainLoop loop;
+    bool resumed = false;
+
+    Task<void> task = victim(loop, resumed);
+    startOwned(task);
+
+    /*
+     * Due before the victim's sleep; both run in one batch once the
+     * loop starts late.
+     */
+    loop.postDelayed(1, [&task]() { task = Task<void>(); });
+    loop.postDelayed(20, [&loop]() { loop.terminate(); });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    loop.loop();
+
+    printf("  %-44s %s\n", "destroyed in the same batch, not resumed", resumed ? "FAILED" : "ok");
+}
+}
+
+int main()
+{
+    Bench::header("Task");
+
+    int total = 0;
+
+    Bench::report("create + run + free (2 frames)", Bench::measure([&total]() { sum(total).detach(); }));
+
+    int result = 0;
+    const uint64_t start = SysTime::getTickCountNs();
+
+    deepChain(100 * 1000, result).detach();
+
+    Bench::reportRate("100k-deep await chain, per level", 100 * 1000, SysTime::getTickCountNs() - start);
+
+    Bench::header("MainLoop round trips");
+
+    benchLoopResume("co_await sleepFor(0)", sleeper);
+    benchLoopResume("co_await switchTo()", switcher);
+
+    Bench::header("checks");
+
+    checkSameBatchDestroy();
+
+    return 0;
+}
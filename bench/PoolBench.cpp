@@ -0,0 +1,260 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "Bench.h"
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * ThreadPool against the usual alternative: one std::function queue
+ * behind a mutex and a condition variable, shared by all workers.
+ *
+ * - tiny posts : an outside thread posts tasks that do next to nothing.
+ * - 2 us tasks : same, each task spins for 2 us.
+ * - fork-join  : a task posts a batch of children from inside the pool;
+ *                the last child to finish ends the round.
+ * - latency    : submit() from an outside thread to the task starting,
+ *                one at a time, p50/p99.
+ *
+ * Each case runs with 2 and 4 workers; ThreadPool with its default spin
+ * and with none.
+ */
+namespace
+{
+class MutexQueuePool
+{
+public:
+    explicit MutexQueuePool(size_t count)
+        : mStop(false)
+    {
+        for (size_t i = 0; i < count; ++i)
+            mThreads.emplace_back([this]() { run(); });
+    }
+
+    ~MutexQueuePool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStop = true;
+        }
+
+        mReady.notify_all();
+
+        for (std::thread& thread : mThreads)
+            thread.join();
+    }
+
+    void post(std::function<void()> func)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mQueue.push_back(std::move(func));
+        }
+
+        mReady.notify_one();
+    }
+
+    template <typename F>
+    std::future<uint64_t> submit(F&& func)
+    {
+        std::shared_ptr<std::promise<uint64_t>> promise(new std::promise<uint64_t>());
+        std::future<uint64_t> future = promise->get_future();
+
+        post([promise, func]() { promise->set_value(func()); });
+
+        return future;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+
+        while (true)
+        {
+            mReady.wait(lock, [this]() { return mStop || !mQueue.empty(); });
+
+            if (mQueue.empty())
+                return;
+
+            std::function<void()> func = std::move(mQueue.front());
+            mQueue.pop_front();
+
+            lock.unlock();
+            func();
+            lock.lock();
+        }
+    }
+
+private:
+    std::mutex                        mLock;
+    std::condition_variable           mReady;
+    std::deque<std::function<void()>> mQueue;
+    bool                              mStop;
+    std::vector<std::thread>          mThreads;
+};
+
+constexpr uint64_t TinyTasks = 400 * 1000;
+constexpr uint64_t SpinTasks = 20 * 1000;
+constexpr uint64_t SpinNs = 2000;
+constexpr uint64_t ForkRounds = 2000;
+constexpr uint64_t ForkWidth = 64;
+constexpr size_t LatencySamples = 2000;
+
+void spinFor(uint64_t ns)
+{
+    const uint64_t until = SysTime::getTickCountNs() + ns;
+
+    while (SysTime::getTickCountNs() < until) { }
+}
+
+void waitFor(const std::atomic<uint64_t>& counter, uint64_t count)
+{
+    while (counter.load(std::memory_order_acquire) < count)
+        std::this_thread::yield();
+}
+
+template <typename Pool>
+void benchPosts(Pool& pool, const char* name, uint64_t count, uint64_t taskNs)
+{
+    std::atomic<uint64_t> done(0);
+
+    const uint64_t start = SysTime::getTickCountNs();
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        pool.post([&done, taskNs]() {
+            if (taskNs > 0)
+                spinFor(taskNs);
+
+            done.fetch_add(1, std::memory_order_release);
+        });
+    }
+
+    waitFor(done, count);
+
+    Bench::reportRate(name, count, SysTime::getTickCountNs() - start);
+}
+
+template <typename Pool>
+void benchForkJoin(Pool& pool, const char* name)
+{
+    std::atomic<uint64_t> rounds(0);
+    std::atomic<uint64_t> pending(0);
+
+    const uint64_t start = SysTime::getTickCountNs();
+
+    for (uint64_t round = 0; round < ForkRounds; ++round)
+    {
+        pending.store(ForkWidth, std::memory_order_relaxed);
+
+        pool.post([&pool, &rounds, &pending]() {
+            for (uint64_t i = 0; i < ForkWidth; ++i)
+            {
+                pool.post([&rounds, &pending]() {
+                    if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        rounds.fetch_add(1, std::memory_order_release);
+                });
+            }
+        });
+
+        waitFor(rounds, round + 1);
+    }
+
+    Bench::reportRate(name, ForkRounds * ForkWidth, SysTime::getTickCountNs() - start);
+}
+
+template <typename Pool>
+void benchLatency(Pool& pool, const char* name)
+{
+    std::vector<uint64_t> samples;
+    samples.reserve(LatencySamples);
+
+    for (size_t i = 0; i < LatencySamples; ++i)
+    {
+        const uint64_t submitted = SysTime::getTickCountNs();
+        const uint64_t started = pool.submit([]() { return SysTime::getTickCountNs(); }).get();
+
+        samples.push_back(started - submitted);
+
+        /*
+         * Let the workers go idle, as between real requests.
+         */
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    const uint64_t p50 = Bench::percentile(samples, 50);
+    const uint64_t p99 = Bench::percentile(samples, 99);
+
+    printf("  %-44s p50 %8llu ns   p99 %8llu ns\n", name,
+           static_cast<unsigned long long>(p50), static_cast<unsigned long long>(p99));
+}
+
+void benchWorkers(size_t workers)
+{
+    char title[64];
+    snprintf(title, sizeof(title), "%zu workers, %ld online CPU(s)", workers, sysconf(_SC_NPROCESSORS_ONLN));
+    Bench::header(title);
+
+    {
+        MutexQueuePool pool(workers);
+
+        benchPosts(pool, "mutex queue, tiny posts", TinyTasks, 0);
+        benchPosts(pool, "mutex queue, 2 us tasks", SpinTasks, SpinNs);
+        benchForkJoin(pool, "mutex queue, fork-join x64");
+        benchLatency(pool, "mutex queue, submit->start");
+    }
+
+    /*
+     * Default spin, and no spin: the setting for oversubscribed CPUs.
+     */
+    const uint32_t spins[] = { 20, 0 };
+
+    for (uint32_t spinUs : spins)
+    {
+        ThreadPool pool(workers, "Bench");
+        pool.setSpin(spinUs);
+        pool.start();
+
+        char name[64];
+
+        snprintf(name, sizeof(name), "ThreadPool spin %u us, tiny posts", spinUs);
+        benchPosts(pool, name, TinyTasks, 0);
+
+        snprintf(name, sizeof(name), "ThreadPool spin %u us, 2 us tasks", spinUs);
+        benchPosts(pool, name, SpinTasks, SpinNs);
+
+        snprintf(name, sizeof(name), "ThreadPool spin %u us, fork-join x64", spinUs);
+        benchForkJoin(pool, name);
+
+        snprintf(name, sizeof(name), "ThreadPool spin %u us, submit->start", spinUs);
+        benchLatency(pool, name);
+
+        pool.stop();
+    }
+}
+}
+
+int main()
+{
+    const size_t counts[] = { 2, 4 };
+
+    for (size_t workers : counts)
+        benchWorkers(workers);
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "Bench.h"
+
+#include "MainLoop.h"
+#include "MpscQueue.h"
+#include "PostedTask.h"
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+/*
+ * Cross-thread posting: producers post tiny functions, one consumer
+ * runs them.
+ *
+ * - mutex list : std::function in a std::list under a mutex, swapped out
+ *                by the consumer (MainLoop::post() before the MPSC queue).
+ * - mpsc + new : MpscQueue, one PostedTask allocated per post.
+ * - MainLoop   : MainLoop::post(), recycled nodes.
+ *
+ * Allocations are counted with a replaced global operator new.
+ */
+namespace
+{
+std::atomic<uint64_t> gAllocations(0);
+}
+
+void* operator new(size_t size)
+{
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+namespace
+{
+constexpr uint64_t TotalPosts = 1600 * 1000;
+
+struct Result
+{
+    uint64_t ns;
+    uint64_t allocations;
+};
+
+/*
+ * Starts producers posting TotalPosts in all, then runs consume()
+ * on this thread until done() is true.
+ */
+template <typename Post, typename Consume, typename Done>
+Result run(size_t producers, Post&& post, Consume&& consume, Done&& done)
+{
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+
+    const uint64_t perThread = TotalPosts / producers;
+
+    for (size_t i = 0; i < producers; ++i)
+    {
+        threads.emplace_back([&]() {
+            while (!go.load(std::memory_order_acquire)) { }
+
+            for (uint64_t n = 0; n < perThread; ++n)
+                post();
+        });
+    }
+
+    const uint64_t allocations = gAllocations.load();
+    const uint64_t start = SysTime::getTickCountNs();
+
+    go.store(true, std::memory_order_release);
+
+    while (!done())
+        consume();
+
+    const uint64_t ns = SysTime::getTickCountNs() - start;
+    const uint64_t allocated = gAllocations.load() - allocations;
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    return Result{ ns, allocated };
+}
+
+void report(const char* name, const Result& result)
+{
+    char line[96];
+
+    snprintf(line, sizeof(line), "%s (%.2f alloc/post)", name,
+             static_cast<double>(result.allocations) / static_cast<double>(TotalPosts));
+
+    Bench::reportRate(line, TotalPosts, result.ns);
+}
+
+void benchMutexList(size_t producers)
+{
+    std::mutex lock;
+    std::list<std::function<void()>> queue;
+    std::list<std::function<void()>> batch;
+
+    uint64_t ran = 0;
+    const uint64_t total = TotalPosts / producers * producers;
+
+    Result result = run(producers,
+        [&]() {
+            std::function<void()> func = [&ran]() { ran++; };
+
+            std::lock_guard<std::mutex> guard(lock);
+            queue.push_back(std::move(func));
+        },
+        [&]() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                batch.swap(queue);
+            }
+
+            for (std::function<void()>& func : batch)
+                func();
+
+            batch.clear();
+        },
+        [&]() { return ran >= total; });
+
+    report("mutex list", result);
+}
+
+void benchMpsc(size_t producers)
+{
+    MpscQueue queue;
+
+    uint64_t ran = 0;
+    const uint64_t total = TotalPosts / producers * producers;
+
+    Result result = run(producers,
+        [&]() { queue.push(new PostedTask(Closure([&ran]() { ran++; }))); },
+        [&]() {
+            while (MpscNode* node = queue.pop())
+            {
+                PostedTask* task = static_cast<PostedTask*>(node);
+
+                task->mFunc();
+                delete task;
+            }
+        },
+        [&]() { return ran >= total; });
+
+    report("mpsc + new", result);
+}
+
+void benchMainLoop(size_t producers)
+{
+    MainLoop loop;
+
+    std::atomic<uint64_t> ran(0);
+    const uint64_t total = TotalPosts / producers * producers;
+
+    std::thread thread([&loop]() { loop.loop(); });
+
+    while (loop.invoke([]() { return 0; }).get() != 0) { }
+
+    /*
+     * The pool grows to the most posts ever in flight; on a loaded
+     * machine producers run far ahead of the loop. The second pass
+     * reuses what the first one grew.
+     */
+    const char* names[] = { "MainLoop::post, cold", "MainLoop::post, warm" };
+
+    for (const char* name : names)
+    {
+        ran.store(0, std::memory_order_relaxed);
+
+        Result result = run(producers,
+            [&]() { loop.post([&ran]() { ran.fetch_add(1, std::memory_order_relaxed); }); },
+            []() { std::this_thread::yield(); },
+            [&]() { return ran.load(std::memory_order_relaxed) >= total; });
+
+        report(name, result);
+    }
+
+    loop.terminate();
+    thread.join();
+}
+}
+
+int main()
+{
+    const size_t counts[] = { 1, 4, 16 };
+
+    for (size_t producers : counts)
+    {
+        char title[64];
+        snprintf(title, sizeof(title), "%zu producer(s), %llu posts", producers,
+                 static_cast<unsigned long long>(TotalPosts));
+        Bench::header(title);
+
+        benchMutexList(producers);
+        benchMpsc(producers);
+        benchMainLoop(producers);
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "Bench.h"
+
+#include "MainLoop.h"
+#include "TimerHeap.h"
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+/*
+ * TimerHeap against the sorted std::list MainLoop used before it.
+ *
+ * - insert+remove : start() and stop() of one timer with n others queued.
+ * - pop+push      : the earliest timer fires and is re-armed.
+ * - Timer start+stop from a foreign thread on a running MainLoop.
+ */
+namespace
+{
+struct BenchNode : public TimerHeapNode
+{
+    uint64_t expiry = 0;
+};
+
+/*
+ * The list MainLoop kept before TimerHeap: duplicate scan and sorted
+ * insert on start(), linear search on stop().
+ */
+class SortedTimerList
+{
+public:
+    void insert(BenchNode* node)
+    {
+        if (std::find(mNodes.begin(), mNodes.end(), node) != mNodes.end())
+            return;
+
+        std::list<BenchNode*>::iterator pos = std::find_if(mNodes.begin(), mNodes.end(),
+            [node](const BenchNode* other) { return node->expiry < other->expiry; });
+
+        mNodes.insert(pos, node);
+    }
+
+    void remove(BenchNode* node)
+    {
+        for (std::list<BenchNode*>::iterator it = mNodes.begin(); it != mNodes.end(); ++it)
+        {
+            if (*it == node)
+            {
+                mNodes.erase(it);
+                return;
+            }
+        }
+    }
+
+    BenchNode* pop()
+    {
+        BenchNode* node = mNodes.front();
+        mNodes.pop_front();
+        return node;
+    }
+
+private:
+    std::list<BenchNode*> mNodes;
+};
+
+constexpr uint64_t Hour = 3600ULL * 1000 * 1000 * 1000;
+
+void benchContainers(size_t count)
+{
+    char title[64];
+    snprintf(title, sizeof(title), "containers, %zu timers queued", count);
+    Bench::header(title);
+
+    std::mt19937_64 random(count);
+    std::vector<BenchNode> nodes(count + 1);
+
+    for (BenchNode& node : nodes)
+        node.expiry = random() % Hour;
+
+    SortedTimerList list;
+    TimerHeap heap;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        list.insert(&nodes[i]);
+        heap.push(&nodes[i], nodes[i].expiry);
+    }
+
+    BenchNode& extra = nodes[count];
+
+    /*
+     * Slow cases need few calls to fill the time budget.
+     */
+    const uint64_t batch = count > 1000 ? 1 : 1024;
+
+    Bench::report("list insert+remove", Bench::measure([&]() {
+        list.insert(&extra);
+        list.remove(&extra);
+    }, 200, batch));
+
+    Bench::report("heap insert+remove", Bench::measure([&]() {
+        heap.push(&extra, extra.expiry);
+        heap.remove(&extra);
+    }, 200, batch));
+
+    uint64_t clock = Hour;
+
+    Bench::report("list pop+push", Bench::measure([&]() {
+        BenchNode* node = list.pop();
+        node->expiry = clock++;
+        list.insert(node);
+    }, 200, batch));
+
+    clock = Hour;
+
+    Bench::report("heap pop+push", Bench::measure([&]() {
+        BenchNode* node = static_cast<BenchNode*>(heap.pop());
+        node->expiry = clock++;
+        heap.push(node, node->expiry);
+    }, 200, batch));
+}
+
+void benchMainLoop(size_t count)
+{
+    char title[64];
+    snprintf(title, sizeof(title), "MainLoop, %zu timers queued", count);
+    Bench::header(title);
+
+    MainLoop loop;
+    std::thread thread([&loop]() { loop.loop(); });
+
+    {
+        std::vector<std::unique_ptr<Timer>> timers;
+        timers.reserve(count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            timers.emplace_back(new Timer(loop.createTimer()));
+            timers.back()->start(3600 * 1000, false);
+        }
+
+        Timer timer(loop.createTimer());
+
+        Bench::report("Timer start+stop, foreign thread", Bench::measure([&]() {
+            timer.start(3600 * 1000, false);
+            timer.stop();
+        }));
+    }
+
+    loop.terminate();
+    thread.join();
+}
+}
+
+int main()
+{
+    const size_t counts[] = { 10, 1000, 100000 };
+
+    for (size_t count : counts)
+        benchContainers(count);
+
+    for (size_t count : counts)
+        benchMainLoop(count);
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "Bench.h"
+
+#include "MainLoop.h"
+
+#include <thread>
+
+/*
+ * Timer lateness (MainLoop::getTimerLateness()) of one periodic Timer,
+ * with the millisecond backend timeout and with setHighResolution().
+ *
+ * Lateness is the time the expired batch was collected minus the
+ * deadline. Without high resolution a sub-millisecond interval cannot be
+ * kept at all, and longer ones are rounded to whole milliseconds.
+ * Percentiles are Histogram bucket bounds, so powers of two minus one.
+ */
+namespace
+{
+constexpr uint32_t RunMs = 1000;
+
+class Counter : public ITimerHandler
+{
+public:
+    bool onTimerExpired(const ITimer& timer) override
+    {
+        (void)timer;
+        return true;
+    }
+};
+
+void benchLateness(bool highResolution, uint32_t intervalUs)
+{
+    MainLoop loop;
+
+    if (highResolution && !loop.setHighResolution(true))
+    {
+        printf("  high resolution not available\n");
+        return;
+    }
+
+    std::thread thread([&loop]() { loop.loop(); });
+
+    {
+        Counter counter;
+        Timer timer(loop.createTimer());
+
+        timer.setHandler(&counter);
+        timer.startUs(intervalUs, true);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(RunMs));
+        timer.stop();
+    }
+
+    loop.terminate();
+    thread.join();
+
+    const Histogram::Snapshot lateness = loop.getTimerLateness();
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s, every %u us", highResolution ? "high resolution" : "ms timeout", intervalUs);
+
+    printf("  %-36s %7llu fired  p50 %8llu ns  p99 %8llu ns  max %9llu ns\n", name,
+           static_cast<unsigned long long>(lateness.count),
+           static_cast<unsigned long long>(lateness.percentile(50)),
+           static_cast<unsigned long long>(lateness.percentile(99)),
+           static_cast<unsigned long long>(lateness.max));
+}
+}
+
+int main()
+{
+    const uint32_t intervals[] = { 250, 1000, 2500 };
+
+    for (bool highResolution : { false, true })
+    {
+        Bench::header(highResolution ? "MainLoop::setHighResolution(true)" : "MainLoop, millisecond timeout");
+
+        for (uint32_t intervalUs : intervals)
+            benchLateness(highResolution, intervalUs);
+    }
+
+    return 0;
+}
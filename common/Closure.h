@@ -0,0 +1,190 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Move-only void() callable with small-buffer storage.
+ *
+ * Unlike std::function:
+ * - it does not require the callable to be copyable, so lambdas that
+ *   capture std::unique_ptr can be stored.
+ * - callables up to InlineSize bytes that are nothrow-movable are stored
+ *   inline and never allocate.
+ *
+ * Usage:
+ *
+ *   std::unique_ptr<Buffer> buf = ...;
+ *   Closure task([buf = std::move(buf)]() { consume(*buf); });
+ *   task();
+ */
+class Closure
+{
+public:
+    static constexpr size_t InlineSize = 6 * sizeof(void*);
+
+public:
+    Closure() noexcept
+        : mOps(nullptr)
+    {
+    }
+
+    Closure(std::nullptr_t) noexcept
+        : mOps(nullptr)
+    {
+    }
+
+    template <typename F,
+              typename Fn = typename std::decay<F>::type,
+              typename = typename std::enable_if<!std::is_same<Fn, Closure>::value>::type>
+    Closure(F&& func)
+        : mOps(nullptr)
+    {
+        /*
+         * Empty std::function / null function pointer stays empty.
+         */
+        if constexpr (std::is_constructible<bool, const Fn&>::value)
+        {
+            if (!static_cast<bool>(func))
+                return;
+        }
+
+        if constexpr (fitsInline<Fn>())
+        {
+            ::new (static_cast<void*>(mStorage)) Fn(std::forward<F>(func));
+            mOps = &InlineOps<Fn>::sOps;
+        }
+        else
+        {
+            *reinterpret_cast<Fn**>(mStorage) = new Fn(std::forward<F>(func));
+            mOps = &HeapOps<Fn>::sOps;
+        }
+    }
+
+    Closure(Closure&& other) noexcept
+        : mOps(nullptr)
+    {
+        moveFrom(other);
+    }
+
+    Closure& operator=(Closure&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+
+        return *this;
+    }
+
+    Closure(const Closure&) = delete;
+    Closure& operator=(const Closure&) = delete;
+
+    ~Closure()
+    {
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        if (mOps)
+        {
+            mOps->destroy(mStorage);
+            mOps = nullptr;
+        }
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return mOps != nullptr;
+    }
+
+    void operator()()
+    {
+        if (mOps)
+            mOps->invoke(mStorage);
+    }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename Fn>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(Fn) <= InlineSize &&
+               alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template <typename Fn>
+    struct InlineOps
+    {
+        static void invoke(void* storage)
+        {
+            (*static_cast<Fn*>(storage))();
+        }
+
+        static void move(void* dst, void* src) noexcept
+        {
+            Fn* from = static_cast<Fn*>(src);
+            ::new (dst) Fn(std::move(*from));
+            from->~Fn();
+        }
+
+        static void destroy(void* storage) noexcept
+        {
+            static_cast<Fn*>(storage)->~Fn();
+        }
+
+        static constexpr Ops sOps { invoke, move, destroy };
+    };
+
+    template <typename Fn>
+    struct HeapOps
+    {
+        static void invoke(void* storage)
+        {
+            (**static_cast<Fn**>(storage))();
+        }
+
+        static void move(void* dst, void* src) noexcept
+        {
+            *static_cast<Fn**>(dst) = *static_cast<Fn**>(src);
+        }
+
+        static void destroy(void* storage) noexcept
+        {
+            delete *static_cast<Fn**>(storage);
+        }
+
+        static constexpr Ops sOps { invoke, move, destroy };
+    };
+
+    void moveFrom(Closure& other) noexcept
+    {
+        if (!other.mOps)
+            return;
+
+        other.mOps->move(mStorage, other.mStorage);
+        mOps = other.mOps;
+        other.mOps = nullptr;
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char mStorage[InlineSize];
+    const Ops* mOps;
+};
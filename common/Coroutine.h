@@ -0,0 +1,533 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "MainLoop.h"
+
+#if HAVE_COROUTINES
+
+#include <coroutine>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+
+/*
+ * Coroutines on MainLoop.
+ *
+ * A handler written as a Task suspends on the loop's awaitables and is
+ * resumed directly from fd dispatch, the timer phase or a posted function,
+ * instead of being split into IFdWatcher / ITimerHandler callbacks:
+ *
+ *   Task<void> session(MainLoop& loop, int fd)
+ *   {
+ *       while (true)
+ *       {
+ *           if (co_await loop.readable(fd) != IFdWatcher::Readable)
+ *               break;
+ *
+ *           ...read(fd)...
+ *           co_await loop.sleepFor(10);
+ *       }
+ *   }
+ *
+ *   session(loop, fd).detach();
+ *
+ * Rules:
+ * - Await from the loop thread; co_await loop.switchTo() gets there.
+ * - A suspended Task may be destroyed on the loop thread only. A pending
+ *   readable()/sleepFor() is cancelled; a pending switchTo() must not be
+ *   left behind.
+ * - Frames still suspended when the loop is destroyed are leaked.
+ * - Exceptions are not used: an escaping exception terminates.
+ */
+
+/*
+ * Thread-local free lists for coroutine frames, in 64-byte size classes
+ * up to 1 KiB. Larger frames go to the global heap.
+ *
+ * A frame freed on another thread is cached on that thread.
+ */
+class FramePool
+{
+public:
+    static void* allocate(size_t size)
+    {
+        const size_t index = getClass(size);
+
+        if (index >= ClassCount)
+            return ::operator new(size);
+
+        Cache& cache = getCache();
+
+        if (FreeBlock* block = cache.head[index])
+        {
+            cache.head[index] = block->next;
+            cache.count[index]--;
+            return block;
+        }
+
+        return ::operator new((index + 1) * Granule);
+    }
+
+    static void deallocate(void* ptr, size_t size)
+    {
+        const size_t index = getClass(size);
+
+        if (index >= ClassCount)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        Cache& cache = getCache();
+
+        if (cache.count[index] >= MaxCached)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+
+        block->next = cache.head[index];
+        cache.head[index] = block;
+        cache.count[index]++;
+    }
+
+private:
+    static constexpr size_t Granule = 64;
+    static constexpr size_t ClassCount = 16;
+    static constexpr size_t MaxCached = 256;   // per class and thread
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct Cache
+    {
+        FreeBlock* head[ClassCount] = {};
+        size_t     count[ClassCount] = {};
+
+        ~Cache()
+        {
+            for (FreeBlock*& block : head)
+            {
+                while (block)
+                {
+                    FreeBlock* next = block->next;
+                    ::operator delete(block);
+                    block = next;
+                }
+            }
+        }
+    };
+
+    static size_t getClass(size_t size)
+    {
+        return size == 0 ? 0 : (size - 1) / Granule;
+    }
+
+    static Cache& getCache()
+    {
+        thread_local Cache sCache;
+        return sCache;
+    }
+};
+
+template <typename T = void>
+class Task;
+
+/*
+ * Lazily started: the body runs when the Task is awaited or detached.
+ * An awaiting coroutine is resumed by symmetric transfer when the body
+ * finishes, so deep chains do not grow the stack.
+ */
+class TaskPromiseBase
+{
+public:
+    static void* operator new(size_t size)
+    {
+        return FramePool::allocate(size);
+    }
+
+    static void operator delete(void* ptr, size_t size)
+    {
+        FramePool::deallocate(ptr, size);
+    }
+
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            TaskPromiseBase& promise = handle.promise();
+
+            if (promise.mContinuation)
+                return promise.mContinuation;
+
+            if (promise.mDetached)
+                handle.destroy();
+
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+
+    void unhandled_exception() const noexcept { std::terminate(); }
+
+protected:
+    template <typename U>
+    friend class Task;
+
+    std::coroutine_handle<> mContinuation;
+    bool mDetached = false;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U&& value)
+    {
+        mValue.emplace(std::forward<U>(value));
+    }
+
+    T takeValue()
+    {
+        return std::move(*mValue);
+    }
+
+private:
+    std::optional<T> mValue;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+    void takeValue() const noexcept {}
+};
+
+template <typename T>
+class Task
+{
+public:
+    using promise_type = TaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+public:
+    Task() noexcept
+        : mHandle(nullptr)
+    {
+    }
+
+    explicit Task(Handle handle) noexcept
+        : mHandle(handle)
+    {
+    }
+
+    Task(Task&& other) noexcept
+        : mHandle(std::exchange(other.mHandle, nullptr))
+    {
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            mHandle = std::exchange(other.mHandle, nullptr);
+        }
+
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        reset();
+    }
+
+    explicit operator bool() const noexcept { return static_cast<bool>(mHandle); }
+
+    bool isDone() const noexcept
+    {
+        return !mHandle || mHandle.done();
+    }
+
+    /*
+     * Starts the body on the calling thread and gives up ownership.
+     * The frame frees itself when the body finishes.
+     */
+    void detach() noexcept
+    {
+        if (!mHandle)
+            return;
+
+        Handle handle = std::exchange(mHandle, nullptr);
+
+        handle.promise().mDetached = true;
+        handle.resume();
+    }
+
+    struct Awaiter
+    {
+        Handle mHandle;
+
+        bool await_ready() const noexcept
+        {
+            return !mHandle || mHandle.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            mHandle.promise().mContinuation = awaiting;
+            return mHandle;
+        }
+
+        T await_resume()
+        {
+            return mHandle.promise().takeValue();
+        }
+    };
+
+    Awaiter operator co_await() && noexcept
+    {
+        return Awaiter{mHandle};
+    }
+
+private:
+    void reset() noexcept
+    {
+        if (mHandle)
+        {
+            mHandle.destroy();
+            mHandle = nullptr;
+        }
+    }
+
+private:
+    Handle mHandle;
+};
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept
+{
+    return Task<T>(Task<T>::Handle::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept
+{
+    return Task<void>(Task<void>::Handle::from_promise(*this));
+}
+
+/*
+ * One-shot fd watch for the duration of a co_await. Resumed from
+ * MainLoop's fd dispatch; the watch is removed before resuming.
+ */
+class FdAwaiter : public IFdWatcher
+{
+public:
+    FdAwaiter(MainLoop& loop, int fd, uint32_t events)
+        : mLoop(loop)
+        , mFd(fd)
+        , mEvents(events)
+        , mResult(0)
+        , mWatching(false)
+    {
+    }
+
+    FdAwaiter(const FdAwaiter&) = delete;
+    FdAwaiter& operator=(const FdAwaiter&) = delete;
+
+    ~FdAwaiter() override
+    {
+        /*
+         * Frame destroyed while suspended.
+         */
+        if (mWatching)
+            mLoop.removeFdWatcher(this);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        mHandle = handle;
+        mWatching = true;
+
+        if (!mLoop.addFdWatcher(this, mEvents | IFdWatcher::OneShot))
+        {
+            mWatching = false;
+            mResult = IFdWatcher::Error;
+            return false;
+        }
+
+        return true;
+    }
+
+    uint32_t await_resume() const noexcept { return mResult; }
+
+    int getFD() override { return mFd; }
+
+    bool onFdReadable(int fd) override
+    {
+        (void)fd;
+        complete(IFdWatcher::Readable);
+        return true;
+    }
+
+    bool onFdWritable(int fd) override
+    {
+        (void)fd;
+        complete(IFdWatcher::Writable);
+        return true;
+    }
+
+    void onFdError(int fd, uint32_t events) override
+    {
+        (void)fd;
+        complete(events);
+    }
+
+private:
+    void complete(uint32_t events)
+    {
+        /*
+         * Removing bumps the fd generation, so the rest of this event
+         * (e.g. Hangup after Readable) is not delivered to us again.
+         * Nothing of this object is touched after resume().
+         */
+        mLoop.removeFdWatcher(this);
+
+        mWatching = false;
+        mResult = events;
+
+        mHandle.resume();
+    }
+
+private:
+    MainLoop&               mLoop;
+    std::coroutine_handle<> mHandle;
+
+    int      mFd;
+    uint32_t mEvents;
+    uint32_t mResult;
+    bool     mWatching;
+};
+
+/*
+ * postDelayed() entry for the duration of a co_await. Resumed from the
+ * timer phase; cancelled if the frame is destroyed while suspended.
+ */
+class SleepAwaiter
+{
+public:
+    SleepAwaiter(MainLoop& loop, uint32_t msec)
+        : mLoop(loop)
+        , mMsec(msec)
+        , mPending(false)
+    {
+    }
+
+    SleepAwaiter(const SleepAwaiter&) = delete;
+    SleepAwaiter& operator=(const SleepAwaiter&) = delete;
+
+    ~SleepAwaiter()
+    {
+        if (mPending)
+            mLoop.cancel(mTask);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        mHandle = handle;
+        mPending = true;
+
+        mTask = mLoop.postDelayed(mMsec, [this]() {
+            mPending = false;
+            mHandle.resume();
+        });
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    MainLoop&               mLoop;
+    std::coroutine_handle<> mHandle;
+    MainLoop::TaskHandle    mTask;
+
+    uint32_t mMsec;
+    bool     mPending;
+};
+
+/*
+ * Resumes the awaiting coroutine from a post() to the loop.
+ */
+class SwitchAwaiter
+{
+public:
+    SwitchAwaiter(MainLoop& loop, MainLoop::Priority priority)
+        : mLoop(loop)
+        , mPriority(priority)
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        mLoop.post([handle]() { handle.resume(); }, mPriority);
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    MainLoop&          mLoop;
+    MainLoop::Priority mPriority;
+};
+
+inline FdAwaiter MainLoop::readable(int fd)
+{
+    return FdAwaiter(*this, fd, IFdWatcher::Readable);
+}
+
+inline FdAwaiter MainLoop::writable(int fd)
+{
+    return FdAwaiter(*this, fd, IFdWatcher::Writable);
+}
+
+inline SleepAwaiter MainLoop::sleepFor(uint32_t msec)
+{
+    return SleepAwaiter(*this, msec);
+}
+
+inline SwitchAwaiter MainLoop::switchTo(Priority priority)
+{
+    return SwitchAwaiter(*this, priority);
+}
+
+#endif /* HAVE_COROUTINES */
@@ -0,0 +1,76 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "EpollBackend.h"
+
+#include "Log.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+EpollBackend::EpollBackend()
+    : mEpollFd(-1)
+{
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0)
+    {
+        LOGE("cannot create epoll fd! errno=%d", errno);
+    }
+}
+
+EpollBackend::~EpollBackend()
+{
+    if (mEpollFd >= 0)
+        close(mEpollFd);
+}
+
+bool EpollBackend::add(int fd, uint32_t events, uint64_t token)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+
+    event.events = events;
+    event.data.u64 = token;
+
+    return epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool EpollBackend::modify(int fd, uint32_t events, uint64_t token)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+
+    event.events = events;
+    event.data.u64 = token;
+
+    return epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+bool EpollBackend::remove(int fd)
+{
+    return epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr) == 0;
+}
+
+int EpollBackend::wait(LoopEvent* events, int maxEvents, int timeoutMs)
+{
+    struct epoll_event ready[MaxEvents];
+
+    if (maxEvents > MaxEvents)
+        maxEvents = MaxEvents;
+
+    const int count = epoll_wait(mEpollFd, ready, maxEvents, timeoutMs);
+
+    for (int i = 0; i < count; ++i)
+    {
+        events[i].token = ready[i].data.u64;
+        events[i].events = ready[i].events;
+    }
+
+    return count;
+}
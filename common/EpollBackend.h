@@ -0,0 +1,35 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "LoopBackend.h"
+
+class EpollBackend : public ILoopBackend
+{
+public:
+    EpollBackend();
+    ~EpollBackend() override;
+
+    EpollBackend(const EpollBackend&) = delete;
+    EpollBackend& operator=(const EpollBackend&) = delete;
+
+    bool isValid() const { return mEpollFd >= 0; }
+
+    Type getType() const override { return Type::Epoll; }
+    const char* getName() const override { return "epoll"; }
+
+    bool add(int fd, uint32_t events, uint64_t token) override;
+    bool modify(int fd, uint32_t events, uint64_t token) override;
+    bool remove(int fd) override;
+
+    int wait(LoopEvent* events, int maxEvents, int timeoutMs) override;
+
+private:
+    static constexpr int MaxEvents = 256;
+
+    int mEpollFd;
+};
@@ -0,0 +1,612 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "PostedTask.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+class InvokeSlot;
+
+/*
+ * Grows on demand, never shrinks. Slots never move (std::deque).
+ *
+ * The slots live in a shared block that outlives the pool while any
+ * Future still holds one: the owner (MainLoop, ThreadPool) may be
+ * destroyed first, and the last release() frees the block.
+ */
+class InvokeSlotPool
+{
+public:
+    InvokeSlotPool();
+    ~InvokeSlotPool();
+
+    InvokeSlotPool(const InvokeSlotPool&) = delete;
+    InvokeSlotPool& operator=(const InvokeSlotPool&) = delete;
+
+    InvokeSlot* acquire();
+
+    static void release(InvokeSlot* slot);
+
+private:
+    friend class InvokeSlot;
+
+    struct Shared;
+
+    Shared* mShared;
+};
+
+/*
+ * Result cell shared by one Future and the function computing it.
+ * Slots are pooled and reused, so a request/response round trip does
+ * not allocate once the pool is warm.
+ *
+ * The state word doubles as a futex: the producer only makes a wake
+ * syscall when the consumer is actually blocked.
+ *
+ * Results up to InlineSize bytes are stored in the slot itself.
+ */
+class InvokeSlot
+{
+public:
+    static constexpr size_t InlineSize = 8 * sizeof(void*);
+
+    explicit InvokeSlot(InvokeSlotPool::Shared& shared)
+        : mShared(shared)
+        , mState(Free)
+        , mDestroy(nullptr)
+        , mTask(this)
+        , mNextFree(nullptr)
+    {
+    }
+
+    InvokeSlot(const InvokeSlot&) = delete;
+    InvokeSlot& operator=(const InvokeSlot&) = delete;
+
+    /*
+     * Producer side: stores func()'s result and wakes the waiter.
+     * If the Future is gone already, the result is dropped and the
+     * slot goes back to the pool.
+     */
+    template <typename R, typename F>
+    void complete(F& func);
+
+    /*
+     * Owner side, for a request that will never run (its loop or pool
+     * is going away): drops the queued function and wakes the waiter,
+     * whose wait() then fails and get() returns R().
+     */
+    void breakPromise();
+
+    /*
+     * Consumer side. timeoutMs: Infinite blocks until ready.
+     */
+    static constexpr uint32_t Infinite = static_cast<uint32_t>(-1);
+
+    bool wait(uint32_t timeoutMs);
+    bool isReady() const;
+    bool isBroken() const;
+
+    template <typename R>
+    R take();
+
+    void abandon();
+
+    /*
+     * Queue node for the request, so posting it does not allocate.
+     */
+    PostedTask* getTask() { return &mTask; }
+
+private:
+    friend class InvokeSlotPool;
+
+    enum State : uint32_t
+    {
+        Free,
+        Pending,
+        Waiting,    // Pending, consumer blocked in futex wait
+        Ready,
+        Abandoned,
+        Broken,     // never going to run
+    };
+
+    template <typename R>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(R) <= InlineSize && alignof(R) <= alignof(std::max_align_t);
+    }
+
+    template <typename R>
+    R* getValue()
+    {
+        if constexpr (fitsInline<R>())
+            return std::launder(reinterpret_cast<R*>(mStorage));
+        else
+            return *reinterpret_cast<R**>(mStorage);
+    }
+
+    template <typename R>
+    static void destroyValue(InvokeSlot* slot)
+    {
+        if constexpr (fitsInline<R>())
+            slot->getValue<R>()->~R();
+        else
+            delete slot->getValue<R>();
+    }
+
+    void publish();
+    void destroyValue();
+
+    void futexWait(uint32_t expected, const struct timespec* timeout);
+    void futexWake();
+
+private:
+    InvokeSlotPool::Shared& mShared;
+
+    std::atomic<uint32_t> mState;
+
+    void (*mDestroy)(InvokeSlot*);
+
+    PostedTask mTask;
+
+    alignas(std::max_align_t) unsigned char mStorage[InlineSize];
+
+    InvokeSlot* mNextFree;
+};
+
+struct InvokeSlotPool::Shared
+{
+    std::mutex             mLock;
+    std::deque<InvokeSlot> mSlots;
+    InvokeSlot*            mFree = nullptr;
+    size_t                 mOutstanding = 0;    // acquired, not yet released
+    bool                   mClosed = false;     // pool destroyed
+};
+
+inline InvokeSlotPool::InvokeSlotPool()
+    : mShared(new Shared())
+{
+}
+
+inline InvokeSlotPool::~InvokeSlotPool()
+{
+    bool last;
+
+    {
+        std::lock_guard<std::mutex> lock(mShared->mLock);
+
+        mShared->mClosed = true;
+        last = mShared->mOutstanding == 0;
+    }
+
+    if (last)
+        delete mShared;
+}
+
+inline InvokeSlot* InvokeSlotPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mShared->mLock);
+
+    InvokeSlot* slot = mShared->mFree;
+
+    if (slot)
+        mShared->mFree = slot->mNextFree;
+    else
+        slot = &mShared->mSlots.emplace_back(*mShared);
+
+    slot->mState.store(InvokeSlot::Pending, std::memory_order_relaxed);
+    slot->mNextFree = nullptr;
+
+    mShared->mOutstanding++;
+
+    return slot;
+}
+
+inline void InvokeSlotPool::release(InvokeSlot* slot)
+{
+    Shared& shared = slot->mShared;
+    bool last;
+
+    {
+        std::lock_guard<std::mutex> lock(shared.mLock);
+
+        slot->mState.store(InvokeSlot::Free, std::memory_order_relaxed);
+        slot->mNextFree = shared.mFree;
+        shared.mFree = slot;
+
+        shared.mOutstanding--;
+        last = shared.mClosed && shared.mOutstanding == 0;
+    }
+
+    if (last)
+        delete &shared;
+}
+
+template <typename R, typename F>
+inline void InvokeSlot::complete(F& func)
+{
+    /*
+     * Only this side touches the storage until the state says Ready.
+     */
+    if constexpr (std::is_void<R>::value)
+    {
+        func();
+    }
+    else if constexpr (fitsInline<R>())
+    {
+        ::new (static_cast<void*>(mStorage)) R(func());
+        mDestroy = &destroyValue<R>;
+    }
+    else
+    {
+        *reinterpret_cast<R**>(mStorage) = new R(func());
+        mDestroy = &destroyValue<R>;
+    }
+
+    publish();
+}
+
+inline void InvokeSlot::publish()
+{
+    uint32_t state = mState.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        if (state == Abandoned)
+        {
+            destroyValue();
+            InvokeSlotPool::release(this);
+            return;
+        }
+
+        if (mState.compare_exchange_weak(state, Ready, std::memory_order_acq_rel))
+            break;
+    }
+
+    if (state == Waiting)
+        futexWake();
+}
+
+inline bool InvokeSlot::wait(uint32_t timeoutMs)
+{
+    uint32_t state = mState.load(std::memory_order_acquire);
+
+    if (state == Ready)
+        return true;
+
+    if (state == Broken)
+        return false;
+
+    struct timespec deadline = {};
+    struct timespec timeout = {};
+
+    if (timeoutMs != Infinite)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += static_cast<long>(timeoutMs % 1000) * 1000000L;
+
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    while (true)
+    {
+        if (state == Pending &&
+            !mState.compare_exchange_weak(state, Waiting, std::memory_order_acquire))
+        {
+            if (state == Ready)
+                return true;
+
+            if (state == Broken)
+                return false;
+
+            continue;
+        }
+
+        if (timeoutMs == Infinite)
+        {
+            futexWait(Waiting, nullptr);
+        }
+        else
+        {
+            struct timespec now;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            timeout.tv_sec = deadline.tv_sec - now.tv_sec;
+            timeout.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+
+            if (timeout.tv_nsec < 0)
+            {
+                timeout.tv_sec--;
+                timeout.tv_nsec += 1000000000L;
+            }
+
+            if (timeout.tv_sec < 0)
+                return false;
+
+            futexWait(Waiting, &timeout);
+        }
+
+        state = mState.load(std::memory_order_acquire);
+
+        if (state == Ready)
+            return true;
+
+        if (state == Broken)
+            return false;
+    }
+}
+
+inline bool InvokeSlot::isReady() const
+{
+    return mState.load(std::memory_order_acquire) == Ready;
+}
+
+inline bool InvokeSlot::isBroken() const
+{
+    return mState.load(std::memory_order_acquire) == Broken;
+}
+
+template <typename R>
+inline R InvokeSlot::take()
+{
+    if (!wait(Infinite))
+    {
+        /*
+         * Broken: there is no result to return.
+         */
+        InvokeSlotPool::release(this);
+
+        if constexpr (std::is_void<R>::value)
+            return;
+        else if constexpr (std::is_default_constructible<R>::value)
+            return R();
+        else
+            abort();
+    }
+
+    if constexpr (std::is_void<R>::value)
+    {
+        InvokeSlotPool::release(this);
+    }
+    else
+    {
+        R value(std::move(*getValue<R>()));
+
+        destroyValue();
+        InvokeSlotPool::release(this);
+
+        return value;
+    }
+}
+
+inline void InvokeSlot::abandon()
+{
+    uint32_t state = mState.load(std::memory_order_acquire);
+
+    while (state != Ready && state != Broken)
+    {
+        if (mState.compare_exchange_weak(state, Abandoned, std::memory_order_acq_rel))
+            return;
+    }
+
+    destroyValue();
+    InvokeSlotPool::release(this);
+}
+
+inline void InvokeSlot::breakPromise()
+{
+    mTask.mFunc = nullptr;
+
+    uint32_t state = mState.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        if (state == Abandoned)
+        {
+            InvokeSlotPool::release(this);
+            return;
+        }
+
+        if (mState.compare_exchange_weak(state, Broken, std::memory_order_acq_rel))
+            break;
+    }
+
+    if (state == Waiting)
+        futexWake();
+}
+
+inline void InvokeSlot::destroyValue()
+{
+    if (mDestroy)
+    {
+        mDestroy(this);
+        mDestroy = nullptr;
+    }
+}
+
+inline void InvokeSlot::futexWait(uint32_t expected, const struct timespec* timeout)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mState), FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+inline void InvokeSlot::futexWake()
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mState), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+/*
+ * Result of MainLoop::invoke(). Move-only, single use.
+ *
+ *   Future<Config> config = loop.invoke([this]() { return mConfig; });
+ *
+ *   if (config.wait(100))
+ *       apply(config.get());
+ *
+ * Dropping a Future without get() is fine: the result is discarded when
+ * it arrives. A Future may outlive its MainLoop (or ThreadPool): if the
+ * request was still queued when the owner went away, the Future is
+ * broken; wait() returns false and get() returns R() (aborts if R has no
+ * default constructor, so check isBroken() first for such types).
+ */
+template <typename R>
+class Future
+{
+public:
+    Future()
+        : mSlot(nullptr)
+        , mInline(false)
+    {
+    }
+
+    explicit Future(InvokeSlot* slot)
+        : mSlot(slot)
+        , mInline(false)
+    {
+    }
+
+    /*
+     * Already computed (invoke() on the loop thread).
+     */
+    template <typename F>
+    static Future makeReady(F& func)
+    {
+        Future future;
+
+        if constexpr (std::is_void<R>::value)
+            func();
+        else
+            future.mValue.emplace(func());
+
+        future.mInline = true;
+        return future;
+    }
+
+    Future(Future&& other) noexcept
+        : mSlot(std::exchange(other.mSlot, nullptr))
+        , mValue(std::move(other.mValue))
+        , mInline(std::exchange(other.mInline, false))
+    {
+    }
+
+    Future& operator=(Future&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+
+            mSlot = std::exchange(other.mSlot, nullptr);
+            mValue = std::move(other.mValue);
+            mInline = std::exchange(other.mInline, false);
+        }
+
+        return *this;
+    }
+
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+
+    ~Future()
+    {
+        reset();
+    }
+
+    /*
+     * true until get() or reset().
+     */
+    bool isValid() const { return mSlot || mInline; }
+
+    bool isReady() const
+    {
+        return mInline || (mSlot && mSlot->isReady());
+    }
+
+    /*
+     * The request was dropped unrun; get() has no result to return.
+     */
+    bool isBroken() const
+    {
+        return mSlot && mSlot->isBroken();
+    }
+
+    /*
+     * @return true if the result is ready, false on timeout or if broken.
+     */
+    bool wait(uint32_t timeoutMs) const
+    {
+        if (mInline)
+            return true;
+
+        return mSlot && mSlot->wait(timeoutMs);
+    }
+
+    /*
+     * Blocks until the result is ready. Call once, on a valid Future.
+     * Returns R() if the Future is broken.
+     */
+    R get()
+    {
+        if (mInline)
+        {
+            mInline = false;
+
+            if constexpr (!std::is_void<R>::value)
+            {
+                R value(std::move(*mValue));
+
+                mValue.reset();
+                return value;
+            }
+            else
+            {
+                return;
+            }
+        }
+
+        InvokeSlot* slot = std::exchange(mSlot, nullptr);
+        return slot->take<R>();
+    }
+
+    void reset()
+    {
+        if (mSlot)
+        {
+            mSlot->abandon();
+            mSlot = nullptr;
+        }
+
+        mValue.reset();
+        mInline = false;
+    }
+
+private:
+    using Value = typename std::conditional<std::is_void<R>::value, bool, R>::type;
+
+    InvokeSlot*          mSlot;
+    std::optional<Value> mValue;
+    bool                 mInline;
+};
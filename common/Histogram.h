@@ -0,0 +1,150 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+/*
+ * Lock-free log2 histogram for latency values (e.g. nanoseconds).
+ *
+ * Bucket 0 counts zero values, bucket i counts values in [2^(i-1), 2^i).
+ * record() is safe from any thread. snapshot() can be taken while other
+ * threads keep recording; the result is not an atomic cut, but every
+ * field is a valid value that was observed.
+ */
+class Histogram
+{
+public:
+    static constexpr size_t BucketCount = 64;
+
+    struct Snapshot
+    {
+        uint64_t count = 0;
+        uint64_t sum   = 0;
+        uint64_t min   = 0;
+        uint64_t max   = 0;
+
+        std::array<uint64_t, BucketCount> buckets {};
+
+        uint64_t mean() const
+        {
+            return count ? sum / count : 0;
+        }
+
+        /*
+         * @return upper bound of the bucket holding the p-th percentile
+         *         (p in 0..100), clamped to max.
+         */
+        uint64_t percentile(double p) const
+        {
+            if (count == 0)
+                return 0;
+
+            uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(count));
+            if (rank >= count)
+                rank = count - 1;
+
+            uint64_t seen = 0;
+
+            for (size_t i = 0; i < BucketCount; ++i)
+            {
+                seen += buckets[i];
+
+                if (seen > rank)
+                {
+                    const uint64_t upper = (i == 0) ? 0 : upperBound(i);
+                    return upper < max ? upper : max;
+                }
+            }
+
+            return max;
+        }
+    };
+
+public:
+    Histogram()
+    {
+        reset();
+    }
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(uint64_t value)
+    {
+        mBuckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+        mSum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t current = mMin.load(std::memory_order_relaxed);
+        while (value < current &&
+               !mMin.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+
+        current = mMax.load(std::memory_order_relaxed);
+        while (value > current &&
+               !mMax.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    Snapshot snapshot() const
+    {
+        Snapshot snap;
+
+        snap.count = mCount.load(std::memory_order_relaxed);
+        snap.sum   = mSum.load(std::memory_order_relaxed);
+        snap.max   = mMax.load(std::memory_order_relaxed);
+        snap.min   = snap.count ? mMin.load(std::memory_order_relaxed) : 0;
+
+        for (size_t i = 0; i < BucketCount; ++i)
+            snap.buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+
+        return snap;
+    }
+
+    void reset()
+    {
+        for (std::atomic<uint64_t>& bucket : mBuckets)
+            bucket.store(0, std::memory_order_relaxed);
+
+        mCount.store(0, std::memory_order_relaxed);
+        mSum.store(0, std::memory_order_relaxed);
+        mMin.store(static_cast<uint64_t>(-1), std::memory_order_relaxed);
+        mMax.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static size_t bucketOf(uint64_t value)
+    {
+        if (value == 0)
+            return 0;
+
+        const size_t bucket = 64 - static_cast<size_t>(__builtin_clzll(value));
+        return bucket < BucketCount ? bucket : BucketCount - 1;
+    }
+
+    static uint64_t upperBound(size_t bucket)
+    {
+        if (bucket >= 64)
+            return static_cast<uint64_t>(-1);
+
+        return (static_cast<uint64_t>(1) << bucket) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BucketCount> mBuckets;
+
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mSum;
+    std::atomic<uint64_t> mMin;
+    std::atomic<uint64_t> mMax;
+};
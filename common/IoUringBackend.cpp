@@ -0,0 +1,525 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "IoUringBackend.h"
+
+#if HAVE_IO_URING
+
+#include "Log.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace
+{
+int ioUringSetup(unsigned entries, struct io_uring_params* params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg, size_t argSize)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+/*
+ * Ring indices are shared with the kernel.
+ */
+unsigned loadAcquire(const unsigned* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned* p, unsigned value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+uint64_t makeUserData(int fd, uint32_t armSeq)
+{
+    return (static_cast<uint64_t>(armSeq) << 32) | static_cast<uint32_t>(fd);
+}
+
+uint32_t toPollEvents(uint32_t mask)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+    /*
+     * poll32_events is word-reversed on big endian.
+     */
+    mask = (mask << 16) | (mask >> 16);
+#endif
+    return mask;
+}
+}
+
+IoUringBackend::IoUringBackend()
+    : mRingFd(-1)
+    , mSqRing(nullptr)
+    , mSqRingSize(0)
+    , mCqRing(nullptr)
+    , mCqRingSize(0)
+    , mSqes(nullptr)
+    , mSqesSize(0)
+    , mSqHead(nullptr)
+    , mSqTail(nullptr)
+    , mSqArray(nullptr)
+    , mSqMask(0)
+    , mSqEntries(0)
+    , mSqLocalTail(0)
+    , mCqHead(nullptr)
+    , mCqTail(nullptr)
+    , mCqMask(0)
+    , mCqes(nullptr)
+{
+    if (!setupRing())
+        teardownRing();
+}
+
+IoUringBackend::~IoUringBackend()
+{
+    teardownRing();
+}
+
+bool IoUringBackend::setupRing()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    params.cq_entries = CqEntries;
+
+    mRingFd = ioUringSetup(SqEntries, &params);
+    if (mRingFd < 0)
+    {
+        LOGW("io_uring_setup failed. errno=%d", errno);
+        return false;
+    }
+
+    /*
+     * There is no feature bit for multishot poll. RSRC_TAGS came with the
+     * same kernel (5.13) and stands in for it.
+     */
+    const uint32_t required = IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+
+    if ((params.features & required) != required)
+    {
+        LOGW("io_uring lacks required features. features=0x%x", params.features);
+        return false;
+    }
+
+    mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+    if (singleMmap)
+    {
+        if (mCqRingSize > mSqRingSize)
+            mSqRingSize = mCqRingSize;
+
+        mCqRingSize = mSqRingSize;
+    }
+
+    mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+    if (mSqRing == MAP_FAILED)
+    {
+        mSqRing = nullptr;
+        LOGE("io_uring SQ ring mmap failed. errno=%d", errno);
+        return false;
+    }
+
+    if (singleMmap)
+    {
+        mCqRing = mSqRing;
+    }
+    else
+    {
+        mCqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+        if (mCqRing == MAP_FAILED)
+        {
+            mCqRing = nullptr;
+            LOGE("io_uring CQ ring mmap failed. errno=%d", errno);
+            return false;
+        }
+    }
+
+    mSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    void* sqes = mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        LOGE("io_uring SQE mmap failed. errno=%d", errno);
+        return false;
+    }
+
+    mSqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(mSqRing);
+    char* cq = static_cast<char*>(mCqRing);
+
+    mSqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    mSqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    mSqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    mSqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    mSqEntries = params.sq_entries;
+    mSqLocalTail = *mSqTail;
+
+    mCqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    mCqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    mCqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    mCqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    /*
+     * SQE slots are used in ring order, so the index array is the identity.
+     */
+    for (unsigned i = 0; i < mSqEntries; ++i)
+        mSqArray[i] = i;
+
+    return true;
+}
+
+void IoUringBackend::teardownRing()
+{
+    if (mSqes)
+        munmap(mSqes, mSqesSize);
+
+    if (mCqRing && mCqRing != mSqRing)
+        munmap(mCqRing, mCqRingSize);
+
+    if (mSqRing)
+        munmap(mSqRing, mSqRingSize);
+
+    mSqes = nullptr;
+    mCqRing = nullptr;
+    mSqRing = nullptr;
+
+    if (mRingFd >= 0)
+    {
+        close(mRingFd);
+        mRingFd = -1;
+    }
+}
+
+int IoUringBackend::enter(unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg, size_t argSize)
+{
+    return ioUringEnter(mRingFd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+unsigned IoUringBackend::publishSqesLocked()
+{
+    storeRelease(mSqTail, mSqLocalTail);
+
+    return mSqLocalTail - loadAcquire(mSqHead);
+}
+
+struct io_uring_sqe* IoUringBackend::getSqeLocked()
+{
+    if (mSqLocalTail - loadAcquire(mSqHead) >= mSqEntries)
+    {
+        /*
+         * SQ full: hand the queued requests to the kernel now, without waiting.
+         * Only happens with a burst of control changes between two waits.
+         */
+        const unsigned pending = publishSqesLocked();
+
+        if (enter(pending, 0, 0, nullptr, 0) < 0)
+            LOGE("io_uring submit failed. errno=%d", errno);
+
+        if (mSqLocalTail - loadAcquire(mSqHead) >= mSqEntries)
+            return nullptr;
+    }
+
+    struct io_uring_sqe* sqe = &mSqes[mSqLocalTail & mSqMask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    ++mSqLocalTail;
+    return sqe;
+}
+
+void IoUringBackend::armLocked(int fd, Registration& reg)
+{
+    struct io_uring_sqe* sqe = getSqeLocked();
+    if (!sqe)
+    {
+        LOGE("io_uring SQ is full. fd=%d", fd);
+        reg.armed = false;
+        return;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = toPollEvents(reg.mask);
+    sqe->user_data = makeUserData(fd, reg.armSeq);
+
+    if (reg.mode == Mode::Edge)
+        sqe->len = IORING_POLL_ADD_MULTI;
+
+    reg.armed = true;
+}
+
+void IoUringBackend::disarmLocked(int fd, Registration& reg)
+{
+    if (reg.armed)
+    {
+        struct io_uring_sqe* sqe = getSqeLocked();
+
+        if (sqe)
+        {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = makeUserData(fd, reg.armSeq);
+            sqe->user_data = IgnoredUserData;
+        }
+        else
+        {
+            LOGE("io_uring SQ is full, poll request leaked. fd=%d", fd);
+        }
+    }
+
+    /*
+     * Completions already posted for the old request no longer match.
+     */
+    reg.armed = false;
+    ++reg.armSeq;
+}
+
+void IoUringBackend::setEvents(Registration& reg, uint32_t events)
+{
+    reg.mask = events & ~static_cast<uint32_t>(EPOLLET | EPOLLONESHOT);
+
+    if (events & EPOLLONESHOT)
+        reg.mode = Mode::OneShot;
+    else if (events & EPOLLET)
+        reg.mode = Mode::Edge;
+    else
+        reg.mode = Mode::Level;
+}
+
+bool IoUringBackend::add(int fd, uint32_t events, uint64_t token)
+{
+    /*
+     * POLL_ADD only reports a bad fd in its completion.
+     * Check here so add() fails the way epoll_ctl() does.
+     */
+    if (fd < 0 || fcntl(fd, F_GETFD) < 0)
+    {
+        errno = EBADF;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+
+    if (static_cast<size_t>(fd) >= mRegs.size())
+        mRegs.resize(static_cast<size_t>(fd) + 1);
+
+    Registration& reg = mRegs[fd];
+
+    /*
+     * A poll request keeps its file alive, so a registration left behind
+     * by a closed fd is not dropped by the kernel as epoll would. Replace it.
+     */
+    if (reg.active)
+        disarmLocked(fd, reg);
+
+    setEvents(reg, events);
+    reg.token = token;
+
+    armLocked(fd, reg);
+
+    if (!reg.armed)
+    {
+        errno = EBUSY;
+        return false;
+    }
+
+    reg.active = true;
+    return true;
+}
+
+bool IoUringBackend::modify(int fd, uint32_t events, uint64_t token)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+
+    if (fd < 0 || static_cast<size_t>(fd) >= mRegs.size() || !mRegs[fd].active)
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    Registration& reg = mRegs[fd];
+
+    disarmLocked(fd, reg);
+
+    setEvents(reg, events);
+    reg.token = token;
+
+    armLocked(fd, reg);
+
+    if (!reg.armed)
+    {
+        reg.active = false;
+        errno = EBUSY;
+        return false;
+    }
+
+    return true;
+}
+
+bool IoUringBackend::remove(int fd)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+
+    if (fd < 0 || static_cast<size_t>(fd) >= mRegs.size() || !mRegs[fd].active)
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    Registration& reg = mRegs[fd];
+
+    disarmLocked(fd, reg);
+    reg.active = false;
+
+    return true;
+}
+
+bool IoUringBackend::handleCqe(const struct io_uring_cqe& cqe, LoopEvent& event)
+{
+    if (cqe.user_data == IgnoredUserData)
+        return false;
+
+    const size_t fd = static_cast<uint32_t>(cqe.user_data);
+    const uint32_t armSeq = static_cast<uint32_t>(cqe.user_data >> 32);
+
+    if (fd >= mRegs.size())
+        return false;
+
+    Registration& reg = mRegs[fd];
+
+    if (!reg.active || reg.armSeq != armSeq)
+        return false;
+
+    /*
+     * Single-shot polls always end here; multishot ones end when the
+     * kernel drops IORING_CQE_F_MORE (e.g. on CQ overflow).
+     */
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+        reg.armed = false;
+
+    if (cqe.res == -ECANCELED)
+    {
+        if (!reg.armed && reg.mode != Mode::OneShot)
+            armLocked(static_cast<int>(fd), reg);
+
+        return false;
+    }
+
+    event.token = reg.token;
+
+    if (cqe.res < 0)
+    {
+        /*
+         * e.g. -EBADF. Reported once as an error, not re-armed.
+         */
+        event.events = EPOLLERR;
+        return true;
+    }
+
+    event.events = static_cast<uint32_t>(cqe.res);
+
+    /*
+     * Level-triggered: the new poll is submitted by the next wait(),
+     * i.e. after this event was dispatched, and completes at once
+     * if the fd is still ready.
+     */
+    if (!reg.armed && reg.mode != Mode::OneShot)
+        armLocked(static_cast<int>(fd), reg);
+
+    return true;
+}
+
+int IoUringBackend::wait(LoopEvent* events, int maxEvents, int timeoutMs)
+{
+    unsigned toSubmit = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        toSubmit = publishSqesLocked();
+    }
+
+    const bool hasCompletions = *mCqHead != loadAcquire(mCqTail);
+
+    int ret = 0;
+
+    if (timeoutMs != 0 && !hasCompletions)
+    {
+        /*
+         * Submit and wait in one syscall. The timeout rides along
+         * in the extended argument instead of a timeout SQE.
+         */
+        struct __kernel_timespec ts;
+        memset(&ts, 0, sizeof(ts));
+
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+
+        if (timeoutMs > 0)
+        {
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000 * 1000;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+
+        ret = enter(toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+    else if (toSubmit > 0)
+    {
+        ret = enter(toSubmit, 0, 0, nullptr, 0);
+    }
+
+    if (ret < 0)
+    {
+        const int err = errno;
+
+        if (err != ETIME && err != EINTR && err != EBUSY && err != EAGAIN)
+            return -1;
+
+        if (err == EINTR && *mCqHead == loadAcquire(mCqTail))
+            return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+
+    unsigned head = *mCqHead;
+    const unsigned tail = loadAcquire(mCqTail);
+
+    int count = 0;
+
+    /*
+     * Stop while the SQ has no room left for re-arming: a forced flush
+     * would re-poll level-triggered fds before their event is handled.
+     */
+    while (head != tail && count < maxEvents && mSqLocalTail - loadAcquire(mSqHead) < mSqEntries)
+    {
+        if (handleCqe(mCqes[head & mCqMask], events[count]))
+            ++count;
+
+        ++head;
+    }
+
+    storeRelease(mCqHead, head);
+
+    return count;
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,133 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "LoopBackend.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+/*
+ * Multishot poll and IORING_ENTER_EXT_ARG need kernel headers >= 5.13.
+ */
+#if defined(IORING_POLL_ADD_MULTI) && defined(IORING_FEAT_EXT_ARG)
+#define HAVE_IO_URING 1
+#else
+#define HAVE_IO_URING 0
+#endif
+
+#if HAVE_IO_URING
+
+#include <mutex>
+#include <vector>
+
+/*
+ * io_uring readiness backend. Small in-tree ring, no liburing.
+ *
+ * Registrations are IORING_OP_POLL_ADD requests:
+ *   - level-triggered : single-shot poll, re-armed when its completion is reaped
+ *   - EPOLLET         : multishot poll, re-armed only if the kernel ends it
+ *   - EPOLLONESHOT    : single-shot poll, re-armed by modify()
+ *
+ * Control changes only queue SQEs. wait() submits everything queued and
+ * waits for completions in a single io_uring_enter(); the timeout is
+ * passed with IORING_ENTER_EXT_ARG, so no timeout SQE is needed.
+ */
+class IoUringBackend : public ILoopBackend
+{
+public:
+    IoUringBackend();
+    ~IoUringBackend() override;
+
+    IoUringBackend(const IoUringBackend&) = delete;
+    IoUringBackend& operator=(const IoUringBackend&) = delete;
+
+    bool isValid() const { return mRingFd >= 0; }
+
+    Type getType() const override { return Type::IoUring; }
+    const char* getName() const override { return "io_uring"; }
+
+    bool add(int fd, uint32_t events, uint64_t token) override;
+    bool modify(int fd, uint32_t events, uint64_t token) override;
+    bool remove(int fd) override;
+
+    bool isControlDeferred() const override { return true; }
+
+    int wait(LoopEvent* events, int maxEvents, int timeoutMs) override;
+
+private:
+    static constexpr unsigned SqEntries = 512;
+    static constexpr unsigned CqEntries = 4 * SqEntries;
+
+    /*
+     * user_data of requests whose completion is ignored (POLL_REMOVE).
+     */
+    static constexpr uint64_t IgnoredUserData = static_cast<uint64_t>(-1);
+
+    enum class Mode : uint8_t
+    {
+        Level,
+        Edge,
+        OneShot
+    };
+
+    struct Registration
+    {
+        uint64_t token = 0;
+        uint32_t mask = 0;      // poll bits, without EPOLLET/EPOLLONESHOT
+        uint32_t armSeq = 0;    // tags user_data; stale completions are dropped
+        Mode     mode = Mode::Level;
+        bool     active = false;
+        bool     armed = false;
+    };
+
+    static void setEvents(Registration& reg, uint32_t events);
+
+    bool setupRing();
+    void teardownRing();
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg, size_t argSize);
+
+    struct io_uring_sqe* getSqeLocked();
+    unsigned publishSqesLocked();
+
+    void armLocked(int fd, Registration& reg);
+    void disarmLocked(int fd, Registration& reg);
+
+    bool handleCqe(const struct io_uring_cqe& cqe, LoopEvent& event);
+
+private:
+    std::mutex                mLock;
+    std::vector<Registration> mRegs;  // indexed by fd
+
+    int mRingFd;
+
+    void*  mSqRing;
+    size_t mSqRingSize;
+    void*  mCqRing;
+    size_t mCqRingSize;
+
+    struct io_uring_sqe* mSqes;
+    size_t               mSqesSize;
+
+    unsigned* mSqHead;
+    unsigned* mSqTail;
+    unsigned* mSqArray;
+    unsigned  mSqMask;
+    unsigned  mSqEntries;
+    unsigned  mSqLocalTail;  // SQEs filled but not yet published
+
+    unsigned* mCqHead;
+    unsigned* mCqTail;
+    unsigned  mCqMask;
+    struct io_uring_cqe* mCqes;
+};
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,32 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "LoopBackend.h"
+
+#include "EpollBackend.h"
+#include "IoUringBackend.h"
+#include "Log.h"
+
+std::unique_ptr<ILoopBackend> ILoopBackend::create(Type type)
+{
+    if (type == Type::IoUring)
+    {
+#if HAVE_IO_URING
+        std::unique_ptr<IoUringBackend> uring(new IoUringBackend());
+
+        if (uring->isValid())
+            return uring;
+#endif
+        LOGW("io_uring backend is not available, falling back to epoll");
+    }
+
+    std::unique_ptr<EpollBackend> epoll(new EpollBackend());
+
+    if (!epoll->isValid())
+        return nullptr;
+
+    return epoll;
+}
@@ -0,0 +1,66 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+/*
+ * One readiness event reported by a backend.
+ *
+ * events uses epoll bit values (EPOLLIN, EPOLLOUT, EPOLLERR, ...),
+ * which are identical to the poll(2) bits io_uring reports.
+ */
+struct LoopEvent
+{
+    uint64_t token;
+    uint32_t events;
+};
+
+/*
+ * I/O multiplexing backend used by MainLoop.
+ *
+ * Interest masks use epoll bits, including EPOLLET and EPOLLONESHOT.
+ * Control methods may be called from any thread; wait() is called from
+ * the loop thread only. Failures return false and set errno.
+ */
+class ILoopBackend
+{
+public:
+    enum class Type
+    {
+        Epoll,
+        IoUring  // falls back to Epoll when the kernel lacks support
+    };
+
+public:
+    virtual ~ILoopBackend() = default;
+
+    virtual Type getType() const = 0;
+    virtual const char* getName() const = 0;
+
+    virtual bool add(int fd, uint32_t events, uint64_t token) = 0;
+    virtual bool modify(int fd, uint32_t events, uint64_t token) = 0;
+    virtual bool remove(int fd) = 0;
+
+    /*
+     * true if control changes made from a foreign thread only reach the
+     * kernel once the loop wakes up (MainLoop then calls wakeup()).
+     */
+    virtual bool isControlDeferred() const { return false; }
+
+    /*
+     * @return number of events, 0 on timeout, -1 on error (errno set).
+     */
+    virtual int wait(LoopEvent* events, int maxEvents, int timeoutMs) = 0;
+
+    /*
+     * @return the requested backend, the epoll backend if the requested
+     *         one is unavailable, or nullptr if neither can be created.
+     */
+    static std::unique_ptr<ILoopBackend> create(Type type);
+};
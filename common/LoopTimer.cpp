@@ -0,0 +1,91 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "LoopTimer.h"
+
+#include "MainLoop.h"
+#include "SysTime.h"
+#include "Log.h"
+
+namespace
+{
+constexpr uint64_t NsPerUs = 1000ULL;
+constexpr uint64_t NsPerMs = 1000ULL * 1000ULL;
+constexpr uint32_t Infinite = static_cast<uint32_t>(-1);
+}
+
+LoopTimerBase::LoopTimerBase(MainLoop& loop, Invoke invoke)
+    : TimerHeapNode(Kind::Callable)
+    , mLoop(loop)
+    , mInvoke(invoke)
+    , mIntervalNs(0)
+    , mBatchIndex(0)
+    , mState(State::Stopped)
+    , mRepeat(false)
+{
+}
+
+LoopTimerBase::~LoopTimerBase()
+{
+    stop();
+}
+
+void LoopTimerBase::start(uint32_t msec, bool repeat)
+{
+    if (msec == Infinite)
+    {
+        LOGE("LoopTimer::start() ignored. interval is Infinite.");
+        return;
+    }
+
+    startNs(msec * NsPerMs, repeat);
+}
+
+void LoopTimerBase::startUs(uint32_t usec, bool repeat)
+{
+    if (usec == Infinite)
+    {
+        LOGE("LoopTimer::startUs() ignored. interval is Infinite.");
+        return;
+    }
+
+    startNs(usec * NsPerUs, repeat);
+}
+
+void LoopTimerBase::startNs(uint64_t intervalNs, bool repeat)
+{
+    stop();
+
+    mIntervalNs = intervalNs;
+    mRepeat = repeat;
+    mState = State::Queued;
+
+    mLoop.addLoopTimer(this, SysTime::getTickCountNs() + intervalNs);
+}
+
+void LoopTimerBase::stop()
+{
+    switch (mState)
+    {
+        case State::Stopped:
+            return;
+
+        case State::Queued:
+            mLoop.removeLoopTimer(this);
+            break;
+
+        case State::Expired:
+            mLoop.dropExpiredLoopTimer(this);
+            break;
+    }
+
+    mState = State::Stopped;
+}
+
+uint32_t LoopTimerBase::getInterval() const
+{
+    return static_cast<uint32_t>(mIntervalNs / NsPerMs);
+}
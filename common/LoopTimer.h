@@ -0,0 +1,95 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "TimerHeap.h"
+
+#include <stdint.h>
+#include <utility>
+
+class MainLoop;
+
+/*
+ * Compact timer owned by one MainLoop and used from its thread only.
+ *
+ * Compared to Timer: no mutexes, no condition variable, no atomics and
+ * no ITimerHandler. The callback is stored inline and called through a
+ * plain function pointer. The base is 40 bytes on LP64.
+ *
+ *   LoopTimer poll(loop, [this]() { pollSensor(); });
+ *   poll.start(100, true);
+ *
+ * LoopTimer<Closure> is the type-erased variant, for containers of
+ * timers with different callbacks.
+ *
+ * Rules:
+ * - start()/stop()/destruction on the loop thread, or before loop() runs.
+ * - The callback may start() or stop() its own timer, but must not
+ *   destroy it.
+ * - No slack or fixed-rate mode; use Timer for those.
+ */
+class LoopTimerBase : private TimerHeapNode
+{
+public:
+    LoopTimerBase(const LoopTimerBase&) = delete;
+    LoopTimerBase& operator=(const LoopTimerBase&) = delete;
+
+    void start(uint32_t msec, bool repeat);
+    void startUs(uint32_t usec, bool repeat);
+    void stop();
+
+    bool isRunning() const { return mState != State::Stopped; }
+
+    uint32_t getInterval() const;
+    bool     getRepeat() const { return mRepeat; }
+
+protected:
+    using Invoke = void (*)(LoopTimerBase*);
+
+    LoopTimerBase(MainLoop& loop, Invoke invoke);
+    ~LoopTimerBase();
+
+private:
+    friend class MainLoop;
+
+    enum class State : uint8_t
+    {
+        Stopped,
+        Queued,     // in the loop's timer heap
+        Expired,    // in the expiry batch being run, see mBatchIndex
+    };
+
+    void startNs(uint64_t intervalNs, bool repeat);
+
+private:
+    MainLoop& mLoop;
+    Invoke    mInvoke;
+    uint64_t  mIntervalNs;
+    uint32_t  mBatchIndex;
+    State     mState;
+    bool      mRepeat;
+};
+
+template <typename F>
+class LoopTimer final : public LoopTimerBase
+{
+public:
+    LoopTimer(MainLoop& loop, F func)
+        : LoopTimerBase(loop, &invoke)
+        , mFunc(std::move(func))
+    {
+    }
+
+private:
+    static void invoke(LoopTimerBase* base)
+    {
+        static_cast<LoopTimer*>(base)->mFunc();
+    }
+
+private:
+    F mFunc;
+};
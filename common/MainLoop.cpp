@@ -10,13 +10,77 @@
 #include "Log.h"
 
 #include <algorithm>
+
 #include <errno.h>
-#include <fcntl.h>
 #include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+namespace
+{
+constexpr uint64_t NsPerUs  = 1000ULL;
+constexpr uint64_t NsPerMs  = 1000ULL * NsPerUs;
+constexpr uint64_t NsPerSec = 1000ULL * NsPerMs;
+
+/*
+ * Shortest spin worth starting: a few zero-timeout polls.
+ */
+constexpr uint64_t MinSpinNs = 2 * NsPerUs;
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+}
+
+namespace
+{
+uint32_t toEpollEvents(uint32_t events)
+{
+    uint32_t epollEvents = 0;
+
+    if (events & IFdWatcher::Readable)
+        epollEvents |= EPOLLIN;
+
+    if (events & IFdWatcher::Writable)
+        epollEvents |= EPOLLOUT;
+
+    if (events & IFdWatcher::ReadHangup)
+        epollEvents |= EPOLLRDHUP;
+
+    if (events & IFdWatcher::EdgeTriggered)
+        epollEvents |= EPOLLET;
+
+    if (events & IFdWatcher::OneShot)
+        epollEvents |= EPOLLONESHOT;
+
+    return epollEvents;
+}
+
+uint32_t toErrorEvents(uint32_t epollEvents)
+{
+    uint32_t events = 0;
+
+    if (epollEvents & EPOLLERR)
+        events |= IFdWatcher::Error;
+
+    if (epollEvents & EPOLLHUP)
+        events |= IFdWatcher::Hangup;
+
+    if (epollEvents & EPOLLRDHUP)
+        events |= IFdWatcher::ReadHangup;
+
+    return events;
+}
+}
 
 #ifndef SAFE_CLOSE
 #define SAFE_CLOSE(fd)      \
@@ -30,82 +94,92 @@
     } while (0)
 #endif
 
-namespace
-{
-bool setNonBlockAndCloseOnExec(int fd)
+void IFdWatcher::onFdError(int fd, uint32_t events)
 {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags < 0)
-        return false;
-
-    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
-        return false;
-
-    flags = fcntl(fd, F_GETFD, 0);
-    if (flags < 0)
-        return false;
-
-    if (fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0)
-        return false;
-
-    return true;
+    if (events & (Error | Hangup))
+        LOGE("fd error. fd=%d events=0x%x", fd, events);
 }
+
+void IFdWatcher::onFdTimeout(int fd, Timeout reason)
+{
+    LOGW("fd timeout. fd=%d reason=%s", fd, reason == Timeout::Idle ? "idle" : "deadline");
 }
 
-MainLoop::MainLoop()
-    : mEpollFd(-1)
-    , mPipe { -1, -1 }
+MainLoop::MainLoop(ILoopBackend::Type backend)
+    : mFdWatcherCount(0)
+    , mFdWatcherEpoch(0)
+    , mCreatedTimerCount(0)
+    , mFdWheelTick(0)
+    , mFdSweepTick(NoExpiry)
+    , mFdTimeoutCount(0)
+    , mDispatchTimeMs(0)
+    , mFreeDelayedTask(NoDelayedTask)
+    , mEventFd(-1)
+    , mTimerFd(-1)
+    , mArmedExpiry(NoExpiry)
+    , mHighResolution(false)
+    , mTimerWakeups(0)
+    , mTimersCoalesced(0)
+    , mStatsEnabled(false)
+    , mStatsActive(false)
+    , mIterations(0)
+    , mBusyPollNs(0)
+    , mSpinBudgetNs(0)
+    , mArrivalNs(0)
+    , mWaitStart(0)
+    , mSpinExhausted(false)
+    , mBusySpinNs(0)
+    , mBusySleepNs(0)
+    , mBusyHits(0)
+    , mBusyMisses(0)
+    , mWakeupPending(false)
     , mTerminated(false)
+    , mLoopThread()
+    , mLooping(false)
 {
-    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
-    if (mEpollFd < 0)
+    mBackend = ILoopBackend::create(backend);
+    if (!mBackend)
     {
-        LOGE("cannot create epoll fd! errno=%d", errno);
+        LOGE("cannot create loop backend!");
         return;
     }
 
-#if defined(__linux__)
-    if (pipe2(mPipe, O_NONBLOCK | O_CLOEXEC) < 0)
-#else
-    if (pipe(mPipe) < 0)
-#endif
+    mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mEventFd < 0)
     {
-        LOGE("cannot create command pipe! errno=%d", errno);
+        LOGE("cannot create wakeup eventfd! errno=%d", errno);
         return;
     }
 
-#if !defined(__linux__)
-    if (!setNonBlockAndCloseOnExec(mPipe[0]) ||
-        !setNonBlockAndCloseOnExec(mPipe[1]))
+    if (!mBackend->add(mEventFd, EPOLLIN, WakeupToken))
     {
-        LOGE("cannot configure command pipe! errno=%d", errno);
-        return;
+        LOGE("%s add wakeup eventfd failed! errno=%d", mBackend->getName(), errno);
+        SAFE_CLOSE(mEventFd);
     }
-#else
-    /*
-     * pipe2() already configured both ends.
-     * Keep this helper referenced for non-Linux builds only.
-     */
-    (void)setNonBlockAndCloseOnExec;
-#endif
-
-    struct epoll_event event;
-    memset(&event, 0, sizeof(event));
-
-    event.events = EPOLLIN;
-    event.data.ptr = nullptr; // nullptr means command pipe.
+}
 
-    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mPipe[0], &event) < 0)
+MainLoop::~MainLoop()
+{
+    for (MpscQueue& queue : mFunctions)
     {
-        LOGE("epoll_ctl add command pipe failed! errno=%d", errno);
+        while (MpscNode* node = queue.pop())
+        {
+            PostedTask* task = static_cast<PostedTask*>(node);
+
+            if (task->mSlot)
+                task->mSlot->breakPromise();
+            else
+                delete task;
+        }
     }
+
+    SAFE_CLOSE(mTimerFd);
+    SAFE_CLOSE(mEventFd);
 }
 
-MainLoop::~MainLoop()
+ILoopBackend::Type MainLoop::getBackendType() const
 {
-    SAFE_CLOSE(mPipe[0]);
-    SAFE_CLOSE(mPipe[1]);
-    SAFE_CLOSE(mEpollFd);
+    return mBackend ? mBackend->getType() : ILoopBackend::Type::Epoll;
 }
 
 Timer MainLoop::createTimer()
@@ -113,411 +187,1702 @@ Timer MainLoop::createTimer()
     return Timer(*this);
 }
 
-void MainLoop::addFdWatcher(IFdWatcher* watcher)
+uint64_t MainLoop::makeFdToken(int fd, uint32_t generation)
+{
+    return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+bool MainLoop::addFdWatcher(IFdWatcher* watcher, uint32_t events, uint32_t idleTimeoutMs)
 {
     if (!watcher)
-        return;
+        return false;
 
-    if (mEpollFd < 0)
+    if (!mBackend)
     {
-        LOGE("epoll fd is invalid!");
-        return;
+        LOGE("loop backend is invalid!");
+        return false;
     }
 
     const int fd = watcher->getFD();
     if (fd < 0)
     {
         LOGE("invalid fd watcher. fd=%d", fd);
-        return;
+        return false;
     }
 
-    struct epoll_event event;
-    memset(&event, 0, sizeof(event));
+    std::lock_guard<std::mutex> lock(mWatcherLock);
+
+    if (static_cast<size_t>(fd) >= mFdSlots.size())
+        mFdSlots.resize(static_cast<size_t>(fd) + 1);
+
+    FdSlot& slot = mFdSlots[fd];
+
+    /*
+     * The backend decides about duplicates: a slot still holding a watcher
+     * whose fd was closed without removeFdWatcher() is simply taken over.
+     * Taking over starts a new generation, as removeFdWatcher() does, so
+     * events and fd timeouts of the old watcher no longer match.
+     */
+    uint32_t generation = slot.generation;
 
-    event.events = EPOLLIN;
-    event.data.ptr = watcher;
+    if (slot.watcher && ++generation == 0)
+        generation = 1;
 
-    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+    if (!mBackend->add(fd, toEpollEvents(events), makeFdToken(fd, generation)))
     {
         if (errno == EEXIST)
-            LOGE("fd watcher already exists in epoll. fd=%d", fd);
+            LOGE("fd watcher already exists in %s. fd=%d", mBackend->getName(), fd);
         else
-            LOGE("epoll_ctl ADD failed. fd=%d errno=%d", fd, errno);
+            LOGE("%s add failed. fd=%d errno=%d", mBackend->getName(), fd, errno);
 
-        return;
+        return false;
     }
 
-    mFdWatchers.add(watcher);
+    if (!slot.watcher)
+        mFdWatcherCount.fetch_add(1, std::memory_order_relaxed);
+    else
+        mFdWatcherEpoch.fetch_add(1, std::memory_order_release);
+
+    slot.watcher = watcher;
+    slot.events = events;
+    slot.generation = generation;
+
+    clearFdTimeoutLocked(slot);
+
+    if (idleTimeoutMs > 0)
+        setFdTimeoutLocked(fd, slot, idleTimeoutMs, 0);
+
+    if (mBackend->isControlDeferred())
+        wakeup();
+
+    return true;
 }
 
-void MainLoop::removeFdWatcher(IFdWatcher* watcher)
+bool MainLoop::modifyFdWatcher(IFdWatcher* watcher, uint32_t events)
 {
     if (!watcher)
-        return;
+        return false;
 
-    const int fd = watcher->getFD();
+    if (!mBackend)
+    {
+        LOGE("loop backend is invalid!");
+        return false;
+    }
 
-    if (mEpollFd >= 0 && fd >= 0)
+    const int fd = watcher->getFD();
+    if (fd < 0)
     {
-        if (epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr) < 0)
-        {
-            if (errno != ENOENT && errno != EBADF)
-            {
-                LOGE("epoll_ctl DEL failed. fd=%d errno=%d", fd, errno);
-            }
-        }
+        LOGE("invalid fd watcher. fd=%d", fd);
+        return false;
     }
 
-    mFdWatchers.remove(watcher);
-}
+    std::lock_guard<std::mutex> lock(mWatcherLock);
 
-void MainLoop::insertTimerLocked(Timer* timer)
-{
-    if (!timer)
-        return;
+    if (static_cast<size_t>(fd) >= mFdSlots.size() || mFdSlots[fd].watcher != watcher)
+    {
+        LOGE("fd watcher is not registered. fd=%d", fd);
+        return false;
+    }
 
-    TimerList::iterator exists =
-        std::find(mTimers.begin(), mTimers.end(), timer);
+    FdSlot& slot = mFdSlots[fd];
 
-    if (exists != mTimers.end())
+    if (!mBackend->modify(fd, toEpollEvents(events), makeFdToken(fd, slot.generation)))
     {
-        LOGE("timer already exists in MainLoop");
-        return;
+        LOGE("%s modify failed. fd=%d errno=%d", mBackend->getName(), fd, errno);
+        return false;
     }
 
-    TimerList::iterator pos =
-        std::find_if(
-            mTimers.begin(),
-            mTimers.end(),
-            [timer](const Timer* other) {
-                return timer->getExpiryFromLoop() < other->getExpiryFromLoop();
-            }
-        );
+    slot.events = events;
 
-    mTimers.insert(pos, timer);
+    if (mBackend->isControlDeferred())
+        wakeup();
+
+    return true;
 }
 
-void MainLoop::addTimer(Timer* timer)
+void MainLoop::removeFdWatcher(IFdWatcher* watcher)
 {
-    if (!timer)
+    if (!watcher)
         return;
 
-    {
-        std::lock_guard<std::mutex> lock(mTimerLock);
-        insertTimerLocked(timer);
-    }
+    const int fd = watcher->getFD();
 
-    wakeup();
-}
+    if (fd < 0)
+        return;
 
-void MainLoop::removeTimer(Timer* timer)
-{
-    if (!timer)
+    std::lock_guard<std::mutex> lock(mWatcherLock);
+
+    if (static_cast<size_t>(fd) >= mFdSlots.size() || mFdSlots[fd].watcher != watcher)
         return;
 
+    if (mBackend)
     {
-        std::lock_guard<std::mutex> lock(mTimerLock);
-
-        for (TimerList::iterator it = mTimers.begin(); it != mTimers.end(); ++it)
+        if (!mBackend->remove(fd))
         {
-            if (*it == timer)
+            if (errno != ENOENT && errno != EBADF)
             {
-                mTimers.erase(it);
-                break;
+                LOGE("%s remove failed. fd=%d errno=%d", mBackend->getName(), fd, errno);
             }
         }
+        else if (mBackend->isControlDeferred())
+        {
+            /*
+             * A pending poll request keeps the file open until submitted.
+             */
+            wakeup();
+        }
     }
 
-    wakeup();
+    FdSlot& slot = mFdSlots[fd];
+
+    /*
+     * New generation: events for the old registration that are still in
+     * the current wait batch no longer match and are dropped.
+     * Generation 0 is reserved for internal tokens.
+     */
+    slot.watcher = nullptr;
+    slot.events = 0;
+
+    clearFdTimeoutLocked(slot);
+
+    if (++slot.generation == 0)
+        slot.generation = 1;
+
+    mFdWatcherEpoch.fetch_add(1, std::memory_order_release);
+    mFdWatcherCount.fetch_sub(1, std::memory_order_relaxed);
 }
 
-Timer* MainLoop::takeExpiredTimerLocked(uint64_t now)
+size_t MainLoop::getFdWatcherCount() const
 {
-    if (mTimers.empty())
-        return nullptr;
+    return mFdWatcherCount.load(std::memory_order_relaxed);
+}
+
+size_t MainLoop::getTimerCount() const
+{
+    std::lock_guard<std::mutex> lock(mTimerLock);
+    return mTimers.size();
+}
 
-    Timer* timer = mTimers.front();
+size_t MainLoop::getCreatedTimerCount() const
+{
+    return mCreatedTimerCount.load(std::memory_order_relaxed);
+}
 
-    if (!timer)
+bool MainLoop::setFdTimeout(IFdWatcher* watcher, uint32_t idleTimeoutMs, uint32_t deadlineMs)
+{
+    if (!watcher)
+        return false;
+
+    const int fd = watcher->getFD();
+    if (fd < 0)
     {
-        mTimers.pop_front();
-        return nullptr;
+        LOGE("invalid fd watcher. fd=%d", fd);
+        return false;
     }
 
-    const uint64_t expiry = timer->getExpiryFromLoop();
+    std::lock_guard<std::mutex> lock(mWatcherLock);
 
-    if (expiry > now)
-        return nullptr;
+    if (static_cast<size_t>(fd) >= mFdSlots.size() || mFdSlots[fd].watcher != watcher)
+    {
+        LOGE("fd watcher is not registered. fd=%d", fd);
+        return false;
+    }
 
-    /*
-     * Transition Queued -> Executing while the timer is still in the list.
-     *
-     * This prevents Timer::~Timer()/stopAndWait() from believing MainLoop
-     * no longer holds the execution path.
-     */
-    const bool canExecute = timer->tryBeginExecuteFromLoop();
+    setFdTimeoutLocked(fd, mFdSlots[fd], idleTimeoutMs, deadlineMs);
+    return true;
+}
 
-    /*
-     * Remove before callback.
-     * MainLoop must not hold mTimerLock while executing user code.
-     */
-    mTimers.pop_front();
+uint64_t MainLoop::getFdTimeoutExpiry(const FdSlot& slot)
+{
+    uint64_t expiry = slot.deadline > 0 ? slot.deadline : NoExpiry;
 
-    if (!canExecute)
-        return nullptr;
+    if (slot.idleTimeout > 0)
+        expiry = std::min(expiry, slot.lastActivity + slot.idleTimeout);
 
-    return timer;
+    return expiry;
 }
 
-uint32_t MainLoop::getNextTimerTimeoutLocked(uint64_t now) const
+void MainLoop::setFdTimeoutLocked(int fd, FdSlot& slot, uint32_t idleTimeoutMs, uint32_t deadlineMs)
 {
-    if (mTimers.empty())
-        return WaitTimeMs;
+    const bool had = slot.idleTimeout > 0 || slot.deadline > 0;
+    const uint64_t now = SysTime::getTickCountMs();
 
-    Timer* timer = mTimers.front();
+    slot.idleTimeout = idleTimeoutMs;
+    slot.lastActivity = now;
+    slot.deadline = deadlineMs > 0 ? now + deadlineMs : 0;
 
-    if (!timer)
-        return 0;
+    const bool has = slot.idleTimeout > 0 || slot.deadline > 0;
 
-    const uint64_t expiry = timer->getExpiryFromLoop();
+    if (has && !had)
+        mFdTimeoutCount.fetch_add(1, std::memory_order_relaxed);
+    else if (had && !has)
+        mFdTimeoutCount.fetch_sub(1, std::memory_order_relaxed);
 
-    if (expiry <= now)
-        return 0;
+    if (!has)
+        return;
 
-    const uint64_t diff = expiry - now;
+    if (mFdWheel.empty())
+        mFdWheel.resize(FdWheelSize);
 
-    if (diff > static_cast<uint64_t>(WaitTimeMs))
-        return WaitTimeMs;
+    /*
+     * Empty wheel: nothing swept it lately, so start it at the present
+     * rather than catching up on ticks that held no entries.
+     */
+    if (mFdSweepTick == NoExpiry)
+        mFdWheelTick = std::max(mFdWheelTick, now / FdTimeoutTickMs);
 
-    return static_cast<uint32_t>(diff);
+    fileFdTimeoutLocked(fd, slot, mFdWheelTick);
 }
 
-uint32_t MainLoop::getNextTimerTimeout()
+void MainLoop::clearFdTimeoutLocked(FdSlot& slot)
 {
-    std::lock_guard<std::mutex> lock(mTimerLock);
-    return getNextTimerTimeoutLocked(SysTime::getTickCountMs());
+    /*
+     * A filed entry is left in the wheel and dropped when swept.
+     */
+    if (slot.idleTimeout > 0 || slot.deadline > 0)
+        mFdTimeoutCount.fetch_sub(1, std::memory_order_relaxed);
+
+    slot.idleTimeout = 0;
+    slot.lastActivity = 0;
+    slot.deadline = 0;
+    slot.timeoutTick = 0;
 }
 
-uint32_t MainLoop::runTimers()
+void MainLoop::fileFdTimeoutLocked(int fd, FdSlot& slot, uint64_t baseTick)
 {
-    Timer* expiredTimer = nullptr;
+    const uint64_t expiry = getFdTimeoutExpiry(slot);
 
-    {
-        std::lock_guard<std::mutex> lock(mTimerLock);
-        expiredTimer = takeExpiredTimerLocked(SysTime::getTickCountMs());
-    }
+    if (expiry == NoExpiry)
+        return;
 
-    if (!expiredTimer)
-    {
-        return getNextTimerTimeout();
-    }
+    /*
+     * First tick at or after the expiry. Beyond one revolution the entry
+     * is parked in the last bucket and re-filed from there.
+     */
+    uint64_t tick = (expiry + FdTimeoutTickMs - 1) / FdTimeoutTickMs;
 
-    const bool keepTimer = expiredTimer->executeFromLoop();
+    tick = std::max(tick, baseTick);
+    tick = std::min(tick, baseTick + FdWheelSize - 1);
 
-    if (keepTimer)
-    {
-        expiredTimer->requeueFromLoop();
-    }
+    /*
+     * Already filed no later than that: the sweep re-files it lazily.
+     */
+    if (slot.timeoutTick != 0 && slot.timeoutTick <= tick)
+        return;
 
-    return getNextTimerTimeout();
-}
+    mFdWheel[tick % FdWheelSize].push_back(FdTimeoutEntry{fd, slot.generation});
+    slot.timeoutTick = tick;
 
-void MainLoop::loop()
-{
-    while(loopOnce()) { /* NOP */ }
+    if (tick < mFdSweepTick)
+        scheduleFdSweepLocked(tick);
 }
 
-bool MainLoop::loopOnce()
+void MainLoop::scheduleFdSweepLocked(uint64_t tick)
 {
-    if (mEpollFd < 0 || mPipe[0] < 0)
-        return false;
+    /*
+     * A cancelled sweep leaves a harmless wakeup behind at most.
+     */
+    cancel(mFdSweepTask);
 
-    while (runFunctions())
-    {
-    }
+    mFdSweepTick = tick;
+    mFdSweepTask = postTaskAt(Closure([this]() { sweepFdTimeouts(); }),
+                              tick * FdTimeoutTickMs * NsPerMs);
+}
 
-    uint32_t timeToWait = 0;
-    while ((timeToWait = runTimers()) == 0)
+void MainLoop::sweepFdTimeouts()
+{
     {
-    }
-
-    static constexpr int MaxEvents = 32;
-    struct epoll_event events[MaxEvents];
-
-    const int eventCount = epoll_wait(
-        mEpollFd,
-        events,
-        MaxEvents,
-        static_cast<int>(timeToWait)
-    );
+        std::lock_guard<std::mutex> lock(mWatcherLock);
 
-    if (eventCount == 0)
-        return true;
-
-    if (eventCount < 0)
-    {
-        if (errno == EINTR)
-            return true;
+        /*
+         * No sweep is posted while this one files entries; the next one
+         * is posted for the earliest non-empty bucket at the end.
+         */
+        mFdSweepTask = TaskHandle();
+        mFdSweepTick = 0;
 
-        LOGE("epoll_wait error occurred! errno=%d", errno);
-        return false;
-    }
+        const uint64_t now = SysTime::getTickCountMs();
+        const uint64_t nowTick = now / FdTimeoutTickMs;
 
-    for (int i = 0; i < eventCount; ++i)
-    {
-        if (events[i].data.ptr == nullptr)
+        for (; mFdWheelTick <= nowTick; ++mFdWheelTick)
         {
-            bool terminated = false;
+            const uint64_t tick = mFdWheelTick;
 
-            if (!drainCommandPipe(terminated))
-                return true;
+            /*
+             * Re-filing never targets the bucket being swept: its ticks
+             * are later than this one and less than a revolution away.
+             * Swapped, so the bucket and the scratch trade storage
+             * instead of allocating.
+             */
+            mFdSweepBucket.swap(mFdWheel[tick % FdWheelSize]);
 
-            if (terminated || mTerminated.load(std::memory_order_acquire))
+            for (const FdTimeoutEntry& entry : mFdSweepBucket)
             {
-                LOGI(">> terminated received.");
-                return false;
+                FdSlot& slot = mFdSlots[entry.fd];
+
+                /*
+                 * Live entry: same registration, and the slot was filed
+                 * for this bucket (possibly revolutions ago while parked).
+                 */
+                if (slot.generation != entry.generation || !slot.watcher ||
+                    slot.timeoutTick == 0 || slot.timeoutTick > tick ||
+                    slot.timeoutTick % FdWheelSize != tick % FdWheelSize)
+                {
+                    continue;
+                }
+
+                slot.timeoutTick = 0;
+
+                /*
+                 * Refreshed by activity since it was filed: file it again.
+                 */
+                if (getFdTimeoutExpiry(slot) > now)
+                {
+                    fileFdTimeoutLocked(entry.fd, slot, tick + 1);
+                    continue;
+                }
+
+                IFdWatcher::Timeout reason = IFdWatcher::Timeout::Idle;
+
+                if (slot.deadline > 0 && slot.deadline <= now)
+                {
+                    reason = IFdWatcher::Timeout::Deadline;
+                    slot.deadline = 0;
+
+                    if (slot.idleTimeout == 0)
+                        mFdTimeoutCount.fetch_sub(1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    slot.lastActivity = now;
+                }
+
+                mFdExpired.push_back(FdTimeoutEvent{slot.watcher, makeFdToken(entry.fd, entry.generation), reason});
+
+                fileFdTimeoutLocked(entry.fd, slot, tick + 1);
             }
 
-            continue;
+            mFdSweepBucket.clear();
         }
 
-        IFdWatcher* watcher = static_cast<IFdWatcher*>(events[i].data.ptr);
-        if (!watcher)
-            continue;
-
-        const int fd = watcher->getFD();
-        if (fd < 0)
-            continue;
+        mFdSweepTick = NoExpiry;
 
-        if (events[i].events & (EPOLLERR | EPOLLHUP))
+        for (size_t i = 0; i < mFdWheel.size(); ++i)
         {
-            LOGE("epoll fd error. fd=%d events=%u", fd, events[i].events);
-        }
+            const uint64_t tick = mFdWheelTick + i;
 
-        if (events[i].events & EPOLLIN)
-        {
-            watcher->onFdReadable(fd);
+            if (!mFdWheel[tick % FdWheelSize].empty())
+            {
+                scheduleFdSweepLocked(tick);
+                break;
+            }
         }
     }
 
-    return true;
-}
-
-void MainLoop::post(const std::function<void()>& func)
-{
+    /*
+     * Callbacks run unlocked, each after checking its watcher is still
+     * registered: an earlier callback may have removed it.
+     */
+    for (const FdTimeoutEvent& event : mFdExpired)
     {
-        std::lock_guard<std::mutex> lock(mFunctionLock);
-        mFunctions.push_back(func);
-    }
-
-    wakeup();
-}
+        IFdWatcher* watcher = lookupFdWatcher(event.token);
 
-bool MainLoop::runFunctions()
-{
-    FunctionList pending;
+        if (watcher != event.watcher)
+            continue;
 
-    {
-        std::lock_guard<std::mutex> lock(mFunctionLock);
-        pending.swap(mFunctions);
-    }
+        const int fd = static_cast<int>(static_cast<uint32_t>(event.token));
+        const IFdWatcher::Timeout reason = event.reason;
 
-    for (FunctionList::iterator it = pending.begin(); it != pending.end(); ++it)
-    {
-        if (*it)
-            (*it)();
+        runCallback([watcher, fd, reason]() { watcher->onFdTimeout(fd, reason); });
     }
 
-    return !pending.empty();
+    mFdExpired.clear();
 }
 
-void MainLoop::sendCommand(LoopCommand command)
+IFdWatcher* MainLoop::lookupFdWatcher(uint64_t token, bool activity, uint64_t* epoch)
 {
-    if (mPipe[1] < 0)
+    const size_t fd = static_cast<uint32_t>(token);
+    const uint32_t generation = static_cast<uint32_t>(token >> 32);
+
+    std::lock_guard<std::mutex> lock(mWatcherLock);
+
+    if (epoch)
+        *epoch = mFdWatcherEpoch.load(std::memory_order_relaxed);
+
+    if (fd >= mFdSlots.size())
+        return nullptr;
+
+    FdSlot& slot = mFdSlots[fd];
+
+    if (slot.generation != generation)
+        return nullptr;
+
+    /*
+     * Only a stamp: the timeout is re-filed when its bucket comes up.
+     */
+    if (activity && slot.idleTimeout > 0 && slot.lastActivity < mDispatchTimeMs)
+        slot.lastActivity = mDispatchTimeMs;
+
+    return slot.watcher;
+}
+
+template <typename F>
+void MainLoop::runCallback(F&& func)
+{
+    if (!mStatsActive)
+    {
+        func();
+        return;
+    }
+
+    const uint64_t start = SysTime::getTickCountNs();
+
+    func();
+
+    recordSince(mCallbackTime, start);
+}
+
+void MainLoop::dispatchFdEvent(uint64_t token, uint32_t ready)
+{
+    const int fd = static_cast<int>(static_cast<uint32_t>(token));
+
+    /*
+     * One locked lookup per event. A callback may remove this watcher (or
+     * another one in the same batch); the epoch tells whether any watcher
+     * left its slot since, and only then is the lookup repeated.
+     */
+    uint64_t epoch = 0;
+    IFdWatcher* watcher = lookupFdWatcher(token, (ready & (EPOLLIN | EPOLLOUT)) != 0, &epoch);
+
+    if (!watcher)
+        return;
+
+    auto revalidate = [this, token, &watcher, &epoch]() {
+        if (mFdWatcherEpoch.load(std::memory_order_acquire) != epoch)
+            watcher = lookupFdWatcher(token, false, &epoch);
+
+        return watcher != nullptr;
+    };
+
+    if (ready & EPOLLIN)
+        runCallback([watcher, fd]() { watcher->onFdReadable(fd); });
+
+    if (ready & EPOLLOUT)
+    {
+        if (!revalidate())
+            return;
+
+        runCallback([watcher, fd]() { watcher->onFdWritable(fd); });
+    }
+
+    if (ready & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+    {
+        if (!revalidate())
+            return;
+
+        runCallback([watcher, fd, ready]() { watcher->onFdError(fd, toErrorEvents(ready)); });
+    }
+}
+
+void MainLoop::insertTimerLocked(Timer* timer)
+{
+    if (!timer)
+        return;
+
+    /*
+     * The heap copies the deadline (expiry + slack) into its own entry.
+     * Timer::mExpiry is only changed while the timer is not queued.
+     */
+    if (!mTimers.push(timer, timer->getDeadlineFromLoop()))
+    {
+        LOGE("timer already exists in MainLoop");
+    }
+}
+
+void MainLoop::removeTimerLocked(Timer* timer)
+{
+    if (!timer)
+        return;
+
+    mTimers.remove(timer);
+}
+
+void MainLoop::addTimer(Timer* timer)
+{
+    if (!timer)
+        return;
+
+    bool earliest = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mTimerLock);
+
+        earliest = timer->getDeadlineFromLoop() < mTimers.topExpiry();
+        insertTimerLocked(timer);
+    }
+
+    /*
+     * The loop already waits for an earlier deadline otherwise.
+     */
+    if (earliest)
+        wakeup();
+}
+
+void MainLoop::removeTimer(Timer* timer)
+{
+    if (!timer)
         return;
 
-    const uint8_t value = static_cast<uint8_t>(command);
+    /*
+     * No wakeup: at worst the loop wakes up for a deadline that is gone
+     * and finds nothing to run.
+     */
+    std::lock_guard<std::mutex> lock(mTimerLock);
+    removeTimerLocked(timer);
+}
+
+void MainLoop::addLoopTimer(LoopTimerBase* timer, uint64_t expiry)
+{
+    bool earliest = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mTimerLock);
+
+        earliest = expiry < mTimers.topExpiry();
+        mTimers.push(timer, expiry);
+    }
+
+    if (earliest)
+        wakeup();
+}
+
+void MainLoop::removeLoopTimer(LoopTimerBase* timer)
+{
+    std::lock_guard<std::mutex> lock(mTimerLock);
+    mTimers.remove(timer);
+}
+
+void MainLoop::dropExpiredLoopTimer(LoopTimerBase* timer)
+{
+    /*
+     * O(1): the timer knows its slot in the batch.
+     */
+    mExpiredTimers[timer->mBatchIndex].callable = nullptr;
+}
+
+void MainLoop::dropExpiredTimer(Timer* timer)
+{
+    for (ExpiredEntry& entry : mExpiredTimers)
+    {
+        if (entry.timer == timer)
+        {
+            entry.timer = nullptr;
+            return;
+        }
+    }
+}
+
+bool MainLoop::isTimerDueLocked(uint64_t now) const
+{
+    if (mTimers.empty())
+        return false;
+
+    if (mTimers.topExpiry() <= now)
+        return true;
+
+    /*
+     * Inside its slack window: run it with this wakeup rather than
+     * waking up for it alone. Only the top is checked, so timers deeper
+     * in the heap may still fire at their own deadline.
+     */
+    const TimerHeapNode* top = mTimers.top();
+
+    return top->getKind() == TimerHeapNode::Kind::Timer &&
+           static_cast<const Timer*>(top)->getExpiryFromLoop() <= now;
+}
+
+void MainLoop::takeExpiredTimersLocked(uint64_t now, TimerBatch& batch, size_t limit)
+{
+    while (batch.size() < limit && isTimerDueLocked(now))
+    {
+        const uint64_t expiry = mTimers.topExpiry();
+
+        if (mTimers.top()->getKind() == TimerHeapNode::Kind::Task)
+        {
+            DelayedTask* task = static_cast<DelayedTask*>(mTimers.pop());
+
+            /*
+             * cancel() takes entries out of the heap, so this one is live.
+             * It is released on requeue.
+             */
+            batch.emplace_back(nullptr, task, nullptr, expiry);
+            continue;
+        }
+
+        if (mTimers.top()->getKind() == TimerHeapNode::Kind::Callable)
+        {
+            LoopTimerBase* callable = static_cast<LoopTimerBase*>(mTimers.pop());
+
+            callable->mState = LoopTimerBase::State::Expired;
+            callable->mBatchIndex = static_cast<uint32_t>(batch.size());
+
+            batch.emplace_back(nullptr, nullptr, callable, expiry);
+            continue;
+        }
+
+        Timer* timer = static_cast<Timer*>(mTimers.top());
+
+        /*
+         * Transition Queued -> Executing while the timer is still in the heap.
+         *
+         * This prevents Timer::~Timer()/stopAndWait() from believing MainLoop
+         * no longer holds the execution path.
+         */
+        const bool canExecute = timer->tryBeginExecuteFromLoop();
+
+        /*
+         * Remove before callback.
+         * MainLoop must not hold mTimerLock while executing user code.
+         */
+        mTimers.pop();
+
+        if (!canExecute)
+            continue;
+
+        batch.emplace_back(timer, nullptr, nullptr, expiry);
+
+        if (expiry > now)
+            mTimersCoalesced.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void MainLoop::requeueTimersLocked(uint64_t now, TimerBatch& batch, size_t executed)
+{
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        ExpiredEntry& entry = batch[i];
+
+        /*
+         * Entries past the executed ones were cut off by the timer budget.
+         * They go back with their original expiry, so they stay due.
+         */
+        const bool deferred = i >= executed;
+
+        if (entry.task)
+        {
+            /*
+             * A deferred task cancelled meanwhile is recycled at once.
+             */
+            if (deferred && entry.task->mFunc)
+                mTimers.push(entry.task, entry.expiry);
+            else
+                releaseDelayedTaskLocked(entry.task);
+
+            continue;
+        }
+
+        if (entry.callable)
+        {
+            requeueLoopTimerLocked(now, entry, deferred);
+            continue;
+        }
+
+        Timer* timer = entry.timer;
+
+        if (!timer)
+            continue;
+
+        if (deferred)
+            timer->deferExecuteFromLoop();
+
+        if (!timer->beginRequeueFromLoop(now, !deferred))
+            continue;
+
+        insertTimerLocked(timer);
+
+        if (!timer->endRequeueFromLoop())
+            removeTimerLocked(timer);
+    }
+}
+
+void MainLoop::requeueLoopTimerLocked(uint64_t now, const ExpiredEntry& entry, bool deferred)
+{
+    LoopTimerBase* timer = entry.callable;
+
+    if (deferred)
+    {
+        timer->mState = LoopTimerBase::State::Queued;
+        mTimers.push(timer, entry.expiry);
+        return;
+    }
+
+    if (!timer->mRepeat)
+    {
+        timer->mState = LoopTimerBase::State::Stopped;
+        return;
+    }
+
+    timer->mState = LoopTimerBase::State::Queued;
+    mTimers.push(timer, now + timer->mIntervalNs);
+}
+
+MainLoop::DelayedTask* MainLoop::acquireDelayedTaskLocked()
+{
+    if (mFreeDelayedTask != NoDelayedTask)
+    {
+        DelayedTask* task = &mDelayedTasks[mFreeDelayedTask];
+
+        mFreeDelayedTask = task->mNextFree;
+        return task;
+    }
+
+    mDelayedTasks.emplace_back();
+
+    DelayedTask* task = &mDelayedTasks.back();
+    task->mIndex = static_cast<uint32_t>(mDelayedTasks.size() - 1);
+
+    return task;
+}
+
+void MainLoop::releaseDelayedTaskLocked(DelayedTask* task)
+{
+    /*
+     * New generation: handles to the finished entry no longer match.
+     */
+    if (++task->mGeneration == 0)
+        task->mGeneration = 1;
+
+    task->mNextFree = mFreeDelayedTask;
+    mFreeDelayedTask = task->mIndex;
+}
+
+MainLoop::TaskHandle MainLoop::postTaskAt(Closure&& func, uint64_t expiry)
+{
+    TaskHandle handle;
+
+    if (!func)
+        return handle;
+
+    bool earliest = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mTimerLock);
+
+        DelayedTask* task = acquireDelayedTaskLocked();
+
+        task->mFunc = std::move(func);
+
+        earliest = expiry < mTimers.topExpiry();
+        mTimers.push(task, expiry);
+
+        handle.index = task->mIndex;
+        handle.generation = task->mGeneration;
+    }
+
+    /*
+     * The loop already waits for an earlier deadline otherwise.
+     */
+    if (earliest)
+        wakeup();
+
+    return handle;
+}
+
+bool MainLoop::cancel(const TaskHandle& handle)
+{
+    if (!handle)
+        return false;
+
+    Closure func;
+
+    {
+        std::lock_guard<std::mutex> lock(mTimerLock);
+
+        if (handle.index >= mDelayedTasks.size())
+            return false;
+
+        DelayedTask& task = mDelayedTasks[handle.index];
+
+        if (task.mGeneration != handle.generation || !task.mFunc)
+            return false;
+
+        func = std::move(task.mFunc);
+
+        /*
+         * Not in the heap: it sits in the loop's expiry batch, which
+         * recycles it on requeue.
+         */
+        if (task.isQueued())
+        {
+            mTimers.remove(&task);
+            releaseDelayedTaskLocked(&task);
+        }
+    }
+
+    /*
+     * Captures are destroyed outside the lock.
+     */
+    return true;
+}
+
+uint32_t MainLoop::getWaitTimeout(uint64_t expiry, uint64_t now)
+{
+    if (expiry <= now)
+        return 0;
+
+    if (mHighResolution)
+    {
+        /*
+         * The timerfd wakes the backend wait at the exact deadline.
+         * The wait timeout is only a safety net.
+         */
+        armTimerFd(expiry);
+        return WaitTimeMs;
+    }
+
+    if (expiry == NoExpiry)
+        return WaitTimeMs;
+
+    /*
+     * Round up: waking before the expiry would only spin.
+     */
+    const uint64_t diff = (expiry - now + NsPerMs - 1) / NsPerMs;
+
+    if (diff > static_cast<uint64_t>(WaitTimeMs))
+        return WaitTimeMs;
+
+    return static_cast<uint32_t>(diff);
+}
+
+void MainLoop::armTimerFd(uint64_t expiry)
+{
+    if (mTimerFd < 0 || expiry == mArmedExpiry)
+        return;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+
+    /*
+     * All-zero it_value disarms the timerfd.
+     */
+    if (expiry != NoExpiry)
+    {
+        spec.it_value.tv_sec = static_cast<time_t>(expiry / NsPerSec);
+        spec.it_value.tv_nsec = static_cast<long>(expiry % NsPerSec);
+    }
+
+    if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+    {
+        LOGE("timerfd_settime failed! errno=%d", errno);
+        return;
+    }
+
+    mArmedExpiry = expiry;
+}
+
+void MainLoop::drainTimerFd()
+{
+    uint64_t expirations = 0;
+    ssize_t ret = 0;
+
+    do
+    {
+        ret = read(mTimerFd, &expirations, sizeof(expirations));
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0 && errno != EAGAIN)
+        LOGE("timerfd read failed! errno=%d", errno);
+
+    mArmedExpiry = NoExpiry;
+}
+
+bool MainLoop::setHighResolution(bool enable)
+{
+    if (!enable)
+    {
+        armTimerFd(NoExpiry);
+        mHighResolution = false;
+        return true;
+    }
+
+    if (mHighResolution)
+        return true;
+
+    if (!mBackend)
+        return false;
+
+    if (mTimerFd < 0)
+    {
+        /*
+         * SysTime tick count uses the CLOCK_MONOTONIC time base.
+         */
+        mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (mTimerFd < 0)
+        {
+            LOGE("cannot create timerfd! errno=%d", errno);
+            return false;
+        }
+
+        if (!mBackend->add(mTimerFd, EPOLLIN, TimerFdToken))
+        {
+            LOGE("%s add timerfd failed! errno=%d", mBackend->getName(), errno);
+            SAFE_CLOSE(mTimerFd);
+            return false;
+        }
+    }
+
+    mHighResolution = true;
+
+    /*
+     * Recompute the wait with the new mode.
+     */
+    wakeup();
+    return true;
+}
+
+bool MainLoop::isHighResolution() const
+{
+    return mHighResolution;
+}
+
+Histogram::Snapshot MainLoop::getTimerLateness() const
+{
+    return mTimerLateness.snapshot();
+}
+
+void MainLoop::resetTimerLateness()
+{
+    mTimerLateness.reset();
+}
+
+void MainLoop::setStatsEnabled(bool enable)
+{
+    mStatsEnabled.store(enable, std::memory_order_relaxed);
+}
+
+bool MainLoop::isStatsEnabled() const
+{
+    return mStatsEnabled.load(std::memory_order_relaxed);
+}
+
+MainLoop::Stats MainLoop::getStats() const
+{
+    Stats stats;
+
+    stats.iterations    = mIterations.load(std::memory_order_relaxed);
+    stats.functions     = mFunctionTime.snapshot();
+    stats.timers        = mTimerTime.snapshot();
+    stats.dispatch      = mDispatchTime.snapshot();
+    stats.sleep         = mSleepTime.snapshot();
+    stats.callbacks     = mCallbackTime.snapshot();
+    stats.postBatch     = mPostBatch.snapshot();
+    stats.timerLateness = mTimerLateness.snapshot();
+
+    stats.busyPoll.spinNs   = mBusySpinNs.load(std::memory_order_relaxed);
+    stats.busyPoll.sleepNs  = mBusySleepNs.load(std::memory_order_relaxed);
+    stats.busyPoll.hits     = mBusyHits.load(std::memory_order_relaxed);
+    stats.busyPoll.misses   = mBusyMisses.load(std::memory_order_relaxed);
+    stats.busyPoll.budgetNs = mSpinBudgetNs.load(std::memory_order_relaxed);
+
+    stats.functionBudgetHits = mBudgets[static_cast<size_t>(Phase::Functions)].hits.load(std::memory_order_relaxed);
+    stats.timerBudgetHits    = mBudgets[static_cast<size_t>(Phase::Timers)].hits.load(std::memory_order_relaxed);
+
+    stats.timerWakeups    = mTimerWakeups.load(std::memory_order_relaxed);
+    stats.timersCoalesced = mTimersCoalesced.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+void MainLoop::resetStats()
+{
+    mIterations.store(0, std::memory_order_relaxed);
+
+    mFunctionTime.reset();
+    mTimerTime.reset();
+    mDispatchTime.reset();
+    mSleepTime.reset();
+    mCallbackTime.reset();
+    mPostBatch.reset();
+    mTimerLateness.reset();
+
+    mBusySpinNs.store(0, std::memory_order_relaxed);
+    mBusySleepNs.store(0, std::memory_order_relaxed);
+    mBusyHits.store(0, std::memory_order_relaxed);
+    mBusyMisses.store(0, std::memory_order_relaxed);
+
+    for (PhaseBudget& budget : mBudgets)
+        budget.hits.store(0, std::memory_order_relaxed);
+
+    mTimerWakeups.store(0, std::memory_order_relaxed);
+    mTimersCoalesced.store(0, std::memory_order_relaxed);
+}
+
+void MainLoop::setPhaseBudget(Phase phase, uint32_t maxItems, uint32_t timeSliceUs)
+{
+    PhaseBudget& budget = mBudgets[static_cast<size_t>(phase)];
+
+    budget.maxItems.store(maxItems, std::memory_order_relaxed);
+    budget.timeSliceUs.store(timeSliceUs, std::memory_order_relaxed);
+}
+
+uint64_t MainLoop::getPhaseDeadline(const PhaseBudget& budget)
+{
+    const uint32_t sliceUs = budget.timeSliceUs.load(std::memory_order_relaxed);
+
+    if (sliceUs == 0)
+        return 0;
+
+    return SysTime::getTickCountNs() + static_cast<uint64_t>(sliceUs) * NsPerUs;
+}
+
+bool MainLoop::isPastDeadline(uint64_t deadline)
+{
+    return deadline != 0 && SysTime::getTickCountNs() >= deadline;
+}
+
+void MainLoop::setBusyPoll(uint32_t maxBudgetUs)
+{
+    const uint64_t maxNs = static_cast<uint64_t>(maxBudgetUs) * NsPerUs;
+
+    /*
+     * Start from the full budget; the loop adapts it from there.
+     * Written here from any thread; the loop thread re-reads both.
+     */
+    mSpinBudgetNs.store(maxNs, std::memory_order_relaxed);
+    mBusyPollNs.store(maxNs, std::memory_order_relaxed);
+
+    wakeup();
+}
+
+uint32_t MainLoop::getBusyPoll() const
+{
+    return static_cast<uint32_t>(mBusyPollNs.load(std::memory_order_relaxed) / NsPerUs);
+}
+
+void MainLoop::updateArrival(uint64_t gapNs)
+{
+    const uint64_t maxNs = mBusyPollNs.load(std::memory_order_relaxed);
+
+    if (mArrivalNs == 0)
+        mArrivalNs = maxNs / 2;
+
+    /*
+     * EWMA, alpha = 1/8. Spin for twice the expected gap, or not at all
+     * when that would exceed the bound: the loop then just sleeps, and
+     * sleep wakeups keep feeding the average until traffic picks up.
+     */
+    mArrivalNs = mArrivalNs - mArrivalNs / 8 + gapNs / 8;
+
+    uint64_t budget = 2 * mArrivalNs;
+
+    if (budget > maxNs)
+        budget = 0;
+    else if (budget < MinSpinNs)
+        budget = MinSpinNs;
+
+    mSpinBudgetNs.store(budget, std::memory_order_relaxed);
+}
+
+bool MainLoop::busyPoll(LoopEvent* events, int maxEvents, uint32_t timeToWait, int& eventCount)
+{
+    const uint64_t start = SysTime::getTickCountNs();
+
+    uint64_t budget = mSpinBudgetNs.load(std::memory_order_relaxed);
+
+    if (budget > static_cast<uint64_t>(timeToWait) * NsPerMs)
+        budget = static_cast<uint64_t>(timeToWait) * NsPerMs;
+
+    /*
+     * Posters now see a pending wakeup and skip the eventfd write;
+     * their work is found by polling the queue below.
+     */
+    mWakeupPending.exchange(true, std::memory_order_acq_rel);
+
+    bool found = false;
+    uint64_t now = start;
+
+    eventCount = 0;
+
+    while (true)
+    {
+        if (hasPendingFunctions())
+        {
+            found = true;
+            break;
+        }
+
+        eventCount = mBackend->wait(events, maxEvents, 0);
+        if (eventCount != 0)
+        {
+            found = true;
+            break;
+        }
+
+        now = SysTime::getTickCountNs();
+        if (now - start >= budget)
+            break;
+
+        cpuRelax();
+    }
+
+    /*
+     * Pairs with the exchange in wakeup(): a poster either sees the flag
+     * cleared and signals the eventfd, or its exchange came first and its
+     * work is visible to the next iteration, which re-checks the queue
+     * and the timers before any blocking wait.
+     */
+    mWakeupPending.exchange(false, std::memory_order_acq_rel);
+
+    now = SysTime::getTickCountNs();
+    mBusySpinNs.fetch_add(now - start, std::memory_order_relaxed);
+
+    if (found)
+    {
+        mBusyHits.fetch_add(1, std::memory_order_relaxed);
+        updateArrival(now - start);
+    }
+    else
+    {
+        mBusyMisses.fetch_add(1, std::memory_order_relaxed);
+        mWaitStart = start;
+    }
+
+    return found;
+}
+
+int MainLoop::waitBlocking(LoopEvent* events, int maxEvents, uint32_t timeToWait)
+{
+    if (mBusyPollNs.load(std::memory_order_relaxed) == 0)
+    {
+        mSpinExhausted = false;
+        return mBackend->wait(events, maxEvents, static_cast<int>(timeToWait));
+    }
 
-    while (true)
+    const uint64_t start = SysTime::getTickCountNs();
+
+    /*
+     * After a missed spin the gap is measured from the start of that spin.
+     */
+    if (!mSpinExhausted)
+        mWaitStart = start;
+
+    mSpinExhausted = false;
+
+    const int eventCount = mBackend->wait(events, maxEvents, static_cast<int>(timeToWait));
+    const uint64_t now = SysTime::getTickCountNs();
+
+    mBusySleepNs.fetch_add(now - start, std::memory_order_relaxed);
+
+    /*
+     * Timeouts are timer deadlines, not arrivals.
+     */
+    if (eventCount > 0)
+        updateArrival(now - mWaitStart);
+
+    return eventCount;
+}
+
+uint64_t MainLoop::recordSince(Histogram& histogram, uint64_t since)
+{
+    const uint64_t now = SysTime::getTickCountNs();
+
+    histogram.record(now - since);
+    return now;
+}
+
+size_t MainLoop::runTimerBatch(TimerBatch& batch, uint64_t now, uint64_t deadline)
+{
+    size_t executed = 0;
+
+    while (executed < batch.size())
     {
-        const ssize_t ret = write(mPipe[1], &value, sizeof(value));
+        if (executed > 0 && isPastDeadline(deadline))
+            break;
 
-        if (ret == static_cast<ssize_t>(sizeof(value)))
-            return;
+        ExpiredEntry& entry = batch[executed++];
 
-        if (ret < 0 && errno == EINTR)
+        /*
+         * Stopped by an earlier callback of this batch.
+         */
+        if (!entry.task && !entry.timer && !entry.callable)
             continue;
 
         /*
-         * Pipe full means MainLoop already has pending commands/wakeup bytes.
+         * Taken out only now: cancel() from an earlier callback of this
+         * batch, or from another thread, still keeps it from running.
          */
-        if (ret < 0 && errno == EAGAIN)
-            return;
+        Closure func;
 
-        if (ret < 0)
-            LOGE("command pipe write failed! errno=%d", errno);
+        if (entry.task)
+        {
+            std::lock_guard<std::mutex> lock(mTimerLock);
+            func = std::move(entry.task->mFunc);
 
-        return;
+            if (!func)
+                continue;
+        }
+
+        /*
+         * Against the deadline: a timer run inside its slack is on time.
+         */
+        mTimerLateness.record(now > entry.expiry ? now - entry.expiry : 0);
+
+        if (entry.task)
+        {
+            runCallback([&func]() { func(); });
+            continue;
+        }
+
+        if (entry.callable)
+        {
+            LoopTimerBase* callable = entry.callable;
+
+            runCallback([callable]() { callable->mInvoke(callable); });
+            continue;
+        }
+
+        Timer* timer = entry.timer;
+
+        bool alive = false;
+        runCallback([timer, &alive]() { alive = timer->executeFromLoop(); });
+
+        if (!alive)
+            entry.timer = nullptr;
     }
+
+    return executed;
 }
 
-bool MainLoop::drainCommandPipe(bool& terminated)
+uint32_t MainLoop::runTimers()
 {
-    terminated = false;
+    TimerBatch& batch = mExpiredTimers;
+    PhaseBudget& budget = mBudgets[static_cast<size_t>(Phase::Timers)];
 
-    if (mPipe[0] < 0)
-        return false;
+    const uint32_t maxItems = budget.maxItems.load(std::memory_order_relaxed);
+    const uint64_t deadline = getPhaseDeadline(budget);
+
+    /*
+     * With a time slice, due entries are taken a chunk at a time, so the
+     * ones the slice does not reach stay in the heap instead of being
+     * taken out and pushed back.
+     */
+    size_t remaining = maxItems ? maxItems : NoLimit;
+    const size_t chunk = deadline ? TimerChunk : NoLimit;
+
+    const uint64_t start = SysTime::getTickCountNs();
+    uint64_t now = start;
+    uint64_t next = NoExpiry;
+
+    bool exhausted = false;
+    bool fired = false;
+
+    std::unique_lock<std::mutex> lock(mTimerLock);
 
     while (true)
     {
-        uint8_t value = 0;
-        const ssize_t ret = read(mPipe[0], &value, sizeof(value));
+        const size_t limit = std::min(chunk, remaining);
 
-        if (ret == static_cast<ssize_t>(sizeof(value)))
+        takeExpiredTimersLocked(start, batch, limit);
+
+        if (batch.empty())
+            break;
+
+        const bool full = batch.size() == limit;
+
+        lock.unlock();
+
+        const size_t executed = runTimerBatch(batch, now, deadline);
+
+        fired = true;
+        remaining -= executed;
+        exhausted = executed < batch.size();
+
+        /*
+         * Survivors are re-armed relative to the end of the batch and
+         * inserted together. Only entries due when the phase started are
+         * taken, so a timer whose new expiry is already due waits for the
+         * next iteration, after fd events are polled.
+         */
+        now = SysTime::getTickCountNs();
+
+        lock.lock();
+
+        requeueTimersLocked(now, batch, executed);
+        batch.clear();
+
+        if (exhausted || !full)
+            break;
+
+        if (remaining == 0 || isPastDeadline(deadline))
         {
-            const LoopCommand command = static_cast<LoopCommand>(value);
+            exhausted = isTimerDueLocked(start);
+            break;
+        }
+    }
 
-            switch (command)
-            {
-                case LoopCommand::Wakeup:
-                    break;
+    next = mTimers.topExpiry();
+    lock.unlock();
+
+    if (fired)
+        mTimerWakeups.fetch_add(1, std::memory_order_relaxed);
+
+    if (exhausted)
+        budget.hits.fetch_add(1, std::memory_order_relaxed);
+
+    return getWaitTimeout(next, now);
+}
+
+void MainLoop::loop()
+{
+    mLoopThread = pthread_self();
+    mLooping.store(true, std::memory_order_release);
+
+    while(loopOnce()) { /* NOP */ }
+
+    mLooping.store(false, std::memory_order_release);
+}
+
+bool MainLoop::isLoopThread() const
+{
+    return mLooping.load(std::memory_order_acquire) &&
+           pthread_equal(mLoopThread, pthread_self()) != 0;
+}
+
+bool MainLoop::loopOnce()
+{
+    if (!mBackend || mEventFd < 0)
+        return false;
+
+    mStatsActive = mStatsEnabled.load(std::memory_order_relaxed);
+
+    uint64_t mark = 0;
+
+    if (mStatsActive)
+    {
+        mIterations.fetch_add(1, std::memory_order_relaxed);
+        mark = SysTime::getTickCountNs();
+    }
+
+    const bool functionsPending = runFunctions();
+
+    if (mStatsActive)
+        mark = recordSince(mFunctionTime, mark);
+
+    uint32_t timeToWait = runTimers();
+
+    /*
+     * Posted work left over by the budget, or posted by a timer callback
+     * (no self-wakeup): only poll fds, then resume.
+     * Left-over timers are still due, so runTimers() already returned 0.
+     */
+    if (functionsPending || hasPendingFunctions())
+        timeToWait = 0;
+
+    if (mStatsActive)
+        mark = recordSince(mTimerTime, mark);
+
+    static constexpr int MaxEvents = 256;
+    LoopEvent events[MaxEvents];
+
+    int eventCount = 0;
+
+    const bool spin = timeToWait > 0 && !mSpinExhausted &&
+                      mSpinBudgetNs.load(std::memory_order_relaxed) > 0 &&
+                      mBusyPollNs.load(std::memory_order_relaxed) > 0;
+
+    MpscQueue& background = mFunctions[static_cast<size_t>(Priority::Background)];
+
+    if (timeToWait > 0 && !background.empty())
+    {
+        /*
+         * The loop would sleep: run background work, unless fds are ready.
+         * The next iteration re-checks posted work and timers first.
+         */
+        eventCount = mBackend->wait(events, MaxEvents, 0);
+
+        if (eventCount == 0)
+        {
+            runQueue(background, BackgroundBatch, 0);
+            return true;
+        }
+    }
+    else if (spin)
+    {
+        if (!busyPoll(events, MaxEvents, timeToWait, eventCount))
+        {
+            /*
+             * Budget used up. Go around once more with wakeups enabled,
+             * so work that skipped the eventfd is seen, then sleep.
+             */
+            mSpinExhausted = true;
+
+            if (mStatsActive)
+                recordSince(mSleepTime, mark);
+
+            return true;
+        }
+    }
+    else
+    {
+        eventCount = waitBlocking(events, MaxEvents, timeToWait);
+    }
+
+    if (mStatsActive)
+        mark = recordSince(mSleepTime, mark);
+
+    if (eventCount == 0)
+        return true;
+
+    if (eventCount < 0)
+    {
+        if (errno == EINTR)
+            return true;
+
+        LOGE("%s wait error occurred! errno=%d", mBackend->getName(), errno);
+        return false;
+    }
+
+    /*
+     * One clock read per batch for idle timeouts, none without them.
+     */
+    if (mFdTimeoutCount.load(std::memory_order_relaxed) > 0)
+        mDispatchTimeMs = SysTime::getTickCountMs();
 
-                case LoopCommand::Terminate:
-                    terminated = true;
-                    break;
+    for (int i = 0; i < eventCount; ++i)
+    {
+        const uint64_t token = events[i].token;
+
+        if (token == WakeupToken)
+        {
+            drainWakeup();
 
-                default:
-                    LOGE("unknown loop command. value=%u", value);
-                    break;
+            if (mTerminated.load(std::memory_order_acquire))
+            {
+                LOGI(">> terminated received.");
+                return false;
             }
 
             continue;
         }
 
+        if (token == TimerFdToken)
+        {
+            /*
+             * Expired timers run at the start of the next iteration.
+             */
+            drainTimerFd();
+            continue;
+        }
+
+        dispatchFdEvent(token, events[i].events);
+    }
+
+    if (mStatsActive)
+        recordSince(mDispatchTime, mark);
+
+    return true;
+}
+
+void MainLoop::postTask(Closure&& func, Priority priority)
+{
+    if (!func)
+        return;
+
+    /*
+     * The closure is stored inline in a recycled node: no allocation
+     * once the pool is warm.
+     */
+    pushTask(mTaskPool.acquire(std::move(func)), priority);
+}
+
+void MainLoop::pushTask(PostedTask* task, Priority priority)
+{
+    mFunctions[static_cast<size_t>(priority)].push(task);
+
+    /*
+     * Background work too: a sleeping loop is idle, which is when it runs.
+     */
+    wakeup();
+}
+
+size_t MainLoop::runQueue(MpscQueue& queue, size_t limit, uint64_t deadline)
+{
+    size_t count = 0;
+
+    while (count < limit)
+    {
+        MpscNode* node = queue.pop();
+        if (!node)
+            break;
+
+        PostedTask* task = static_cast<PostedTask*>(node);
+
+        if (task->mSlot)
+        {
+            Closure func = std::move(task->mFunc);
+
+            runCallback([&func]() { func(); });
+        }
+        else
+        {
+            runCallback([task]() { task->mFunc(); });
+
+            task->mFunc = nullptr;
+            mTaskPool.release(task);
+        }
+
+        ++count;
+
+        if (isPastDeadline(deadline))
+            break;
+    }
+
+    return count;
+}
+
+bool MainLoop::hasPendingFunctions() const
+{
+    return !mFunctions[static_cast<size_t>(Priority::Urgent)].empty() ||
+           !mFunctions[static_cast<size_t>(Priority::Normal)].empty();
+}
+
+bool MainLoop::runFunctions()
+{
+    MpscQueue& urgent = mFunctions[static_cast<size_t>(Priority::Urgent)];
+    MpscQueue& normal = mFunctions[static_cast<size_t>(Priority::Normal)];
+
+    PhaseBudget& budget = mBudgets[static_cast<size_t>(Phase::Functions)];
+
+    const uint32_t maxItems = budget.maxItems.load(std::memory_order_relaxed);
+    const size_t limit = maxItems ? maxItems : NoLimit;
+    const uint64_t deadline = getPhaseDeadline(budget);
+
+    size_t count = 0;
+
+    /*
+     * Urgent work preempts Normal work at batch boundaries.
+     */
+    while (true)
+    {
+        count += runQueue(urgent, limit - count, deadline);
+
+        if (count >= limit || isPastDeadline(deadline))
+            break;
+
+        const size_t ran = runQueue(normal, std::min(NormalBatch, limit - count), deadline);
+        count += ran;
+
+        if (ran < NormalBatch)
+        {
+            /*
+             * Normal is drained, or the budget is spent.
+             */
+            if (count < limit && !isPastDeadline(deadline))
+                count += runQueue(urgent, limit - count, deadline);
+
+            break;
+        }
+    }
+
+    const bool exhausted = (count >= limit || isPastDeadline(deadline)) && hasPendingFunctions();
+
+    if (exhausted)
+        budget.hits.fetch_add(1, std::memory_order_relaxed);
+
+    /*
+     * The queue keeps no length; the drained batch is the depth it
+     * had reached by the time this iteration got to it.
+     */
+    if (mStatsActive)
+        mPostBatch.record(count);
+
+    return exhausted;
+}
+
+void MainLoop::signalWakeup()
+{
+    if (mEventFd < 0)
+        return;
+
+    const uint64_t value = 1;
+
+    while (true)
+    {
+        const ssize_t ret = write(mEventFd, &value, sizeof(value));
+
+        if (ret == static_cast<ssize_t>(sizeof(value)))
+            return;
+
         if (ret < 0 && errno == EINTR)
             continue;
 
+        /*
+         * Counter saturated means MainLoop is already signaled.
+         */
         if (ret < 0 && errno == EAGAIN)
-            return true;
+            return;
 
-        if (ret == 0)
-            return true;
+        if (ret < 0)
+            LOGE("wakeup eventfd write failed! errno=%d", errno);
 
-        LOGE("command pipe read failed! errno=%d", errno);
-        return false;
+        return;
     }
 }
 
+void MainLoop::drainWakeup()
+{
+    if (mEventFd < 0)
+        return;
+
+    /*
+     * A single read resets the eventfd counter, however many
+     * wakeups were coalesced into it.
+     */
+    uint64_t value = 0;
+    ssize_t ret = 0;
+
+    do
+    {
+        ret = read(mEventFd, &value, sizeof(value));
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0 && errno != EAGAIN)
+        LOGE("wakeup eventfd read failed! errno=%d", errno);
+
+    /*
+     * Clear the pending flag only after the counter is consumed.
+     * A poster racing with this either saw the flag set (and its work is
+     * picked up by the next runFunctions()/runTimers()), or sees it clear
+     * and signals the eventfd again.
+     */
+    mWakeupPending.exchange(false, std::memory_order_acq_rel);
+}
+
 void MainLoop::wakeup()
 {
-    sendCommand(LoopCommand::Wakeup);
+    /*
+     * Called from a callback: the loop re-checks posted work and timers
+     * before it waits again.
+     */
+    if (isLoopThread())
+        return;
+
+    /*
+     * Only the first caller since the last drain pays for the syscall.
+     */
+    if (mWakeupPending.exchange(true, std::memory_order_acq_rel))
+        return;
+
+    signalWakeup();
 }
 
 void MainLoop::terminate()
 {
     /*
-     * Atomic flag protects termination even if command pipe is full.
+     * Atomic flag is the termination state; the eventfd only wakes the loop.
+     * Signal unconditionally: this is also called from signal handlers and
+     * must not depend on the wakeup pending flag.
      */
     mTerminated.store(true, std::memory_order_release);
-    sendCommand(LoopCommand::Terminate);
+    signalWakeup();
 }
@@ -7,83 +7,714 @@
 #pragma once
 
 #include "Timer.h"
-#include "ObserverList.h"
+#include "LoopTimer.h"
+#include "TimerHeap.h"
+#include "Closure.h"
+#include "Future.h"
+#include "Histogram.h"
+#include "MpscQueue.h"
+#include "PostedTask.h"
+#include "LoopBackend.h"
+#include "SysTime.h"
 
 #include <atomic>
-#include <functional>
-#include <list>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <pthread.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Coroutine support (Coroutine.h) needs a C++20 compiler.
+ */
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define HAVE_COROUTINES 1
+#endif
+#endif
+
+#ifndef HAVE_COROUTINES
+#define HAVE_COROUTINES 0
+#endif
+
+#if HAVE_COROUTINES
+class FdAwaiter;
+class SleepAwaiter;
+class SwitchAwaiter;
+#endif
 
 class IFdWatcher
 {
 public:
+    /*
+     * Interest mask for MainLoop::addFdWatcher()/modifyFdWatcher(),
+     * and the condition mask passed to onFdError().
+     */
+    enum Event : uint32_t
+    {
+        Readable      = 1u << 0,
+        Writable      = 1u << 1,
+        ReadHangup    = 1u << 2, // peer shut down its writing side (EPOLLRDHUP)
+
+        EdgeTriggered = 1u << 3, // EPOLLET
+        OneShot       = 1u << 4, // EPOLLONESHOT, re-arm with modifyFdWatcher()
+
+        /*
+         * Always reported, never need to be requested.
+         */
+        Error         = 1u << 5,
+        Hangup        = 1u << 6,
+    };
+
     virtual ~IFdWatcher() = default;
 
     virtual int  getFD() = 0;
     virtual bool onFdReadable(int fd) = 0;
+
+    /*
+     * Called when Writable interest is set and the fd can be written.
+     */
+    virtual bool onFdWritable(int fd) { (void)fd; return true; }
+
+    /*
+     * Called with Error, Hangup and/or ReadHangup.
+     * Readable/Writable callbacks for the same event run first,
+     * so buffered input can still be consumed.
+     *
+     * Default: log Error/Hangup.
+     */
+    virtual void onFdError(int fd, uint32_t events);
+
+    enum class Timeout : uint8_t
+    {
+        Idle,       // no readable/writable callback for the idle timeout
+        Deadline,   // the deadline given to MainLoop::setFdTimeout() passed
+    };
+
+    /*
+     * Called on the loop thread when a timeout set with addFdWatcher() or
+     * MainLoop::setFdTimeout() expires. The watcher stays registered:
+     * an idle timeout fires again after another idle period, a deadline
+     * fires once. Removing the watcher from here is fine.
+     *
+     * Default: log it.
+     */
+    virtual void onFdTimeout(int fd, Timeout reason);
 };
 
 class MainLoop
 {
 public:
-    MainLoop();
+    /*
+     * backend: I/O multiplexer. IoUring falls back to Epoll when the
+     *          kernel lacks support; see getBackendType().
+     */
+    explicit MainLoop(ILoopBackend::Type backend = ILoopBackend::Type::Epoll);
     ~MainLoop();
 
+    ILoopBackend::Type getBackendType() const;
+
     Timer createTimer();
 
-    void addFdWatcher(IFdWatcher* watcher);
+    /*
+     * events       : IFdWatcher::Event interest mask.
+     * idleTimeoutMs: 0 for none, see setFdTimeout().
+     *
+     * @return false if the fd is invalid or already watched.
+     */
+    bool addFdWatcher(IFdWatcher* watcher, uint32_t events = IFdWatcher::Readable, uint32_t idleTimeoutMs = 0);
+    bool modifyFdWatcher(IFdWatcher* watcher, uint32_t events);
     void removeFdWatcher(IFdWatcher* watcher);
 
-    void post(const std::function<void()>& func);
+    /*
+     * Timeouts of a registered watcher, reported to IFdWatcher::onFdTimeout().
+     *
+     * idleTimeoutMs: that long without a readable/writable callback.
+     *                Activity only stamps the fd slot; the timeout is
+     *                re-filed when the sweep finds it was refreshed.
+     * deadlineMs   : once, that long from now, activity or not.
+     *
+     * 0 clears. Timeouts are swept in buckets of FdTimeoutTickMs, so one
+     * fires up to a tick late, never early. Thread-safe.
+     */
+    static constexpr uint32_t FdTimeoutTickMs = 100;
+
+    bool setFdTimeout(IFdWatcher* watcher, uint32_t idleTimeoutMs, uint32_t deadlineMs = 0);
+
+    /*
+     * Load indicators, e.g. for MainLoopGroup. Safe from any thread.
+     * getTimerCount()        : queued timers and delayed tasks.
+     * getCreatedTimerCount() : Timers made by createTimer() and not yet
+     *                          destroyed, started or not.
+     */
+    size_t getFdWatcherCount() const;
+    size_t getTimerCount() const;
+    size_t getCreatedTimerCount() const;
+
+    /*
+     * post() lanes. Each lane is FIFO.
+     *
+     * Urgent     : control messages. Run first, and again between batches
+     *              of Normal work, so a burst of bulk posts cannot delay them.
+     * Normal     : regular work (default).
+     * Background : housekeeping. Runs only when the loop is otherwise idle
+     *              (no due timers, no ready fds), a batch at a time.
+     */
+    enum class Priority : uint8_t
+    {
+        Urgent,
+        Normal,
+        Background,
+    };
+
+    /*
+     * Runs func on the loop thread. Thread-safe.
+     *
+     * func is moved into the queue, so move-only callables
+     * (e.g. lambdas capturing std::unique_ptr) are accepted. Callables
+     * up to Closure::InlineSize bytes are stored in a recycled node: no
+     * allocation per call once warm.
+     */
+    template <typename F>
+    void post(F&& func, Priority priority = Priority::Normal);
+
+    /*
+     * Handle to a postDelayed()/postAt() entry. Default: invalid.
+     * Stays safe to use after the entry ran or was cancelled.
+     */
+    struct TaskHandle
+    {
+        uint32_t index = 0;
+        uint32_t generation = 0;  // 0: invalid
+
+        explicit operator bool() const { return generation != 0; }
+    };
+
+    /*
+     * Runs func once on the loop thread, msec from now, or when the
+     * SysTime::getTickCountMs() clock reaches deadlineMs.
+     *
+     * No Timer object: entries are pooled in the loop and share the
+     * timer heap. Thread-safe.
+     *
+     * @return handle for cancel(), invalid if func is empty.
+     */
+    template <typename F>
+    TaskHandle postDelayed(uint32_t msec, F&& func);
+
+    template <typename F>
+    TaskHandle postAt(uint64_t deadlineMs, F&& func);
+
+    /*
+     * O(log n). The closure is destroyed at once, and the entry leaves
+     * the timer heap and goes back to the pool. An entry the loop has
+     * already taken into its expiry batch is recycled after the batch.
+     *
+     * @return true if func will not run, false if it already ran,
+     *         is running, or the handle is invalid.
+     */
+    bool cancel(const TaskHandle& handle);
+
+    /*
+     * Runs func on the loop thread and hands its result back through a
+     * Future backed by a pooled slot: no allocation per call once warm
+     * (results up to InvokeSlot::InlineSize bytes). Called on the loop
+     * thread, func runs inline and the Future is ready at once.
+     *
+     *   Future<int> state = loop.invoke([this]() { return mState; });
+     *
+     *   if (state.wait(50))
+     *       use(state.get());
+     *
+     * Thread-safe.
+     */
+    template <typename F, typename R = typename std::decay<typename std::invoke_result<F&>::type>::type>
+    Future<R> invoke(F&& func, Priority priority = Priority::Normal);
+
+#if HAVE_COROUTINES
+    /*
+     * Awaitables for coroutines, defined in Coroutine.h:
+     *
+     *   co_await loop.readable(fd);   // resumes from fd dispatch
+     *   co_await loop.sleepFor(100);  // resumes from the timer phase
+     *   co_await loop.switchTo();     // resumes from a post()
+     *
+     * readable()/writable() return the IFdWatcher::Event bits that were
+     * reported, Error if the fd could not be watched.
+     */
+    FdAwaiter     readable(int fd);
+    FdAwaiter     writable(int fd);
+    SleepAwaiter  sleepFor(uint32_t msec);
+    SwitchAwaiter switchTo(Priority priority = Priority::Normal);
+#endif
 
     void loop();
     void wakeup();
     void terminate();
 
+    /*
+     * true on the thread running loop(). Calls made there skip the
+     * self-wakeup, and Timer stops do not wait for the loop.
+     */
+    bool isLoopThread() const;
+
+    /*
+     * High-resolution timer mode.
+     *
+     * Timers are waited with a loop-owned timerfd armed to the earliest
+     * deadline (nanosecond precision) instead of the millisecond
+     * backend wait timeout. Needed for sub-millisecond Timer::startUs().
+     *
+     * Call before loop(), or from the loop thread.
+     */
+    bool setHighResolution(bool enable);
+    bool isHighResolution() const;
+
+    /*
+     * Timer lateness, in nanoseconds: time the expired batch was collected
+     * minus the timer's expiry. Safe to call from any thread.
+     */
+    Histogram::Snapshot getTimerLateness() const;
+    void resetTimerLateness();
+
+    /*
+     * Busy polling. Collected whenever busy polling is enabled,
+     * independent of setStatsEnabled().
+     */
+    struct BusyPollStats
+    {
+        uint64_t spinNs = 0;    // spent spinning
+        uint64_t sleepNs = 0;   // spent in blocking waits
+        uint64_t hits = 0;      // spins that found work
+        uint64_t misses = 0;    // spins that ran out of budget
+        uint64_t budgetNs = 0;  // current adaptive budget
+    };
+
+    /*
+     * Per-iteration budgets, so posted work or a timer storm cannot keep
+     * the loop from polling fds. When a phase spends its budget, the loop
+     * polls fds without blocking and resumes the phase next iteration.
+     *
+     * Functions : posted Urgent + Normal functions.
+     * Timers    : expired timers and postDelayed()/postAt() entries.
+     *
+     * maxItems    : items per iteration, 0 = unlimited (default).
+     * timeSliceUs : time per iteration, 0 = unlimited (default). Checked
+     *               after each item; at least one item always runs.
+     *
+     * Safe from any thread.
+     */
+    enum class Phase : uint8_t
+    {
+        Functions,
+        Timers,
+    };
+
+    void setPhaseBudget(Phase phase, uint32_t maxItems, uint32_t timeSliceUs = 0);
+
+    /*
+     * Busy-poll mode, for latency-critical loops.
+     *
+     * Before blocking, the loop spins for up to the adaptive budget,
+     * checking the post queue and polling the backend without a timeout.
+     * While it spins, post()/wakeup() skip the eventfd write. The budget
+     * follows the recent event inter-arrival time (EWMA) and drops to 0
+     * while events arrive too rarely for spinning to pay off.
+     * Only pays off when the loop has a core to itself.
+     *
+     * maxBudgetUs: budget upper bound. 0 disables busy polling (default).
+     * Safe from any thread.
+     */
+    void     setBusyPoll(uint32_t maxBudgetUs);
+    uint32_t getBusyPoll() const;
+
+    /*
+     * Loop instrumentation. Durations are in nanoseconds.
+     */
+    struct Stats
+    {
+        uint64_t iterations = 0;
+
+        Histogram::Snapshot functions;      // runFunctions() per iteration
+        Histogram::Snapshot timers;         // runTimers() per iteration
+        Histogram::Snapshot dispatch;       // fd event dispatch per iteration
+        Histogram::Snapshot sleep;          // backend wait per iteration
+        Histogram::Snapshot callbacks;      // each posted function, timer handler and fd callback
+        Histogram::Snapshot postBatch;      // posted functions drained per iteration (count)
+        Histogram::Snapshot timerLateness;  // same as getTimerLateness()
+
+        BusyPollStats busyPoll;
+
+        uint64_t functionBudgetHits = 0;    // iterations that left posted work for later
+        uint64_t timerBudgetHits = 0;       // iterations that left expired timers for later
+
+        /*
+         * Timer coalescing, see Timer::setSlack(). Each coalesced timer
+         * ran before its deadline in a wakeup it did not cause: a wakeup
+         * saved, unless another event would have woken the loop anyway.
+         */
+        uint64_t timerWakeups = 0;          // iterations that ran timers
+        uint64_t timersCoalesced = 0;       // timers run inside their slack
+    };
+
+    /*
+     * Off by default. When disabled the loop only reads one flag per
+     * iteration. Takes effect from the next iteration. Safe from any thread.
+     */
+    void setStatsEnabled(bool enable);
+    bool isStatsEnabled() const;
+
+    /*
+     * Taken while the loop keeps running; see Histogram::snapshot().
+     */
+    Stats getStats() const;
+    void  resetStats();
+
 private:
     MainLoop(const MainLoop&) = delete;
     MainLoop& operator=(const MainLoop&) = delete;
 
     bool loopOnce();
     friend class Timer;
+    friend class LoopTimerBase;
 
     void addTimer(Timer* timer);
     void removeTimer(Timer* timer);
 
+    /*
+     * Loop thread only: forget a timer stopped while it sits in the
+     * expiry batch being run.
+     */
+    void dropExpiredTimer(Timer* timer);
+
+    void addLoopTimer(LoopTimerBase* timer, uint64_t expiry);
+    void removeLoopTimer(LoopTimerBase* timer);
+    void dropExpiredLoopTimer(LoopTimerBase* timer);
+
     uint32_t runTimers();
     bool     runFunctions();
 
-    enum class LoopCommand : uint8_t
+    struct PhaseBudget
     {
-        Wakeup    = 'S',
-        Terminate = 'T'
+        std::atomic<uint32_t> maxItems{0};
+        std::atomic<uint32_t> timeSliceUs{0};
+        std::atomic<uint64_t> hits{0};
     };
 
-    void sendCommand(LoopCommand command);
-    bool drainCommandPipe(bool& terminated);
+    static uint64_t getPhaseDeadline(const PhaseBudget& budget);
+    static bool     isPastDeadline(uint64_t deadline);
+
+    template <typename F>
+    void runCallback(F&& func);
+
+    bool busyPoll(LoopEvent* events, int maxEvents, uint32_t timeToWait, int& eventCount);
+    int  waitBlocking(LoopEvent* events, int maxEvents, uint32_t timeToWait);
+    void updateArrival(uint64_t gapNs);
+
+    static uint64_t recordSince(Histogram& histogram, uint64_t since);
+
+    void postTask(Closure&& func, Priority priority);
+    void pushTask(PostedTask* task, Priority priority);
+
+    size_t runQueue(MpscQueue& queue, size_t limit, uint64_t deadline);
+
+    struct DelayedTask : public TimerHeapNode
+    {
+        DelayedTask() : TimerHeapNode(Kind::Task) { }
+
+        Closure  mFunc;              // empty once cancelled
+        uint32_t mIndex = 0;
+        uint32_t mGeneration = 1;
+        uint32_t mNextFree = 0;
+    };
+
+    static constexpr uint32_t NoDelayedTask = static_cast<uint32_t>(-1);
+
+    TaskHandle postTaskAt(Closure&& func, uint64_t expiry);
+
+    DelayedTask* acquireDelayedTaskLocked();
+    void releaseDelayedTaskLocked(DelayedTask* task);
+    bool   hasPendingFunctions() const;
+
+    struct FdSlot
+    {
+        IFdWatcher* watcher = nullptr;
+        uint32_t    generation = 1;
+        uint32_t    events = 0;
+
+        /*
+         * Timeouts, in SysTime::getTickCountMs() time; 0 = none.
+         * timeoutTick: wheel tick of the slot's live entry, 0 = not filed.
+         */
+        uint32_t    idleTimeout = 0;
+        uint64_t    lastActivity = 0;
+        uint64_t    deadline = 0;
+        uint64_t    timeoutTick = 0;
+    };
+
+    /*
+     * Backend token = (generation << 32) | fd.
+     * Generation 0 is never given to a watcher; it tags internal fds.
+     */
+    static constexpr uint64_t WakeupToken  = 0;
+    static constexpr uint64_t TimerFdToken = 1;
+
+    static uint64_t makeFdToken(int fd, uint32_t generation);
+
+    /*
+     * activity: stamp the slot for its idle timeout.
+     * epoch: receives mFdWatcherEpoch as seen under the lock.
+     */
+    IFdWatcher* lookupFdWatcher(uint64_t token, bool activity = false, uint64_t* epoch = nullptr);
+    void dispatchFdEvent(uint64_t token, uint32_t ready);
+
+    /*
+     * Fd timeout wheel: FdWheelSize buckets of FdTimeoutTickMs, so
+     * filing is O(1) and a sweep only visits the bucket that is due.
+     * A slot has one live entry; entries left behind by a removal or an
+     * earlier re-filing are recognized and dropped when swept.
+     */
+    struct FdTimeoutEntry
+    {
+        int      fd;
+        uint32_t generation;
+    };
+
+    struct FdTimeoutEvent
+    {
+        IFdWatcher*         watcher;
+        uint64_t            token;
+        IFdWatcher::Timeout reason;
+    };
+
+    static constexpr size_t FdWheelSize = 256;
+
+    static uint64_t getFdTimeoutExpiry(const FdSlot& slot);
+
+    void setFdTimeoutLocked(int fd, FdSlot& slot, uint32_t idleTimeoutMs, uint32_t deadlineMs);
+    void clearFdTimeoutLocked(FdSlot& slot);
+    void fileFdTimeoutLocked(int fd, FdSlot& slot, uint64_t baseTick);
+    void scheduleFdSweepLocked(uint64_t tick);
+    void sweepFdTimeouts();
+
+    void signalWakeup();
+    void drainWakeup();
+
+    /*
+     * One expired heap entry: a Timer, a LoopTimer or a delayed task.
+     * A task keeps its closure until just before it runs, so cancel()
+     * still stops it while it waits in the batch. The task entry stays
+     * allocated until the batch is requeued, so an entry left over by
+     * the timer budget can go back.
+     */
+    struct ExpiredEntry
+    {
+        ExpiredEntry(Timer* t, DelayedTask* d, LoopTimerBase* c, uint64_t e)
+            : timer(t), task(d), callable(c), expiry(e) { }
+
+        /*
+         * One of timer/task/callable is set. timer and callable are
+         * reset to nullptr when the timer is done or stopped meanwhile.
+         */
+        Timer*         timer;
+        DelayedTask*   task;
+        LoopTimerBase* callable;
+        uint64_t       expiry;
+    };
+
+    using TimerBatch = std::vector<ExpiredEntry>;
 
     void insertTimerLocked(Timer* timer);
-    Timer* takeExpiredTimerLocked(uint64_t now);
+    void removeTimerLocked(Timer* timer);
 
-    uint32_t getNextTimerTimeoutLocked(uint64_t now) const;
-    uint32_t getNextTimerTimeout();
+    bool isTimerDueLocked(uint64_t now) const;
+    void takeExpiredTimersLocked(uint64_t now, TimerBatch& batch, size_t limit);
+    void requeueTimersLocked(uint64_t now, TimerBatch& batch, size_t executed);
+    void requeueLoopTimerLocked(uint64_t now, const ExpiredEntry& entry, bool deferred);
+    size_t runTimerBatch(TimerBatch& batch, uint64_t now, uint64_t deadline);
+
+    uint32_t getWaitTimeout(uint64_t expiry, uint64_t now);
+
+    void armTimerFd(uint64_t expiry);
+    void drainTimerFd();
 
 private:
     static constexpr uint32_t WaitTimeMs = 10 * 1000;
+    static constexpr uint64_t NoExpiry = static_cast<uint64_t>(-1);
+
+    /*
+     * Indexed by fd. O(1) add/remove/lookup.
+     */
+    std::mutex          mWatcherLock;
+    std::vector<FdSlot> mFdSlots;
+    std::atomic<size_t> mFdWatcherCount;
 
-    using TimerList = std::list<Timer*>;
-    using FunctionList = std::list<std::function<void()>>;
+    /*
+     * Bumped under mWatcherLock whenever a watcher leaves its slot, so a
+     * dispatch can tell without the lock that its lookup still holds.
+     */
+    std::atomic<uint64_t> mFdWatcherEpoch;
 
-    RawObserverList<IFdWatcher, 30> mFdWatchers;
+    /*
+     * Live Timer objects, counted by Timer itself.
+     */
+    std::atomic<size_t> mCreatedTimerCount;
 
-    std::mutex mTimerLock;
-    TimerList mTimers;
+    /*
+     * Fd timeouts, guarded by mWatcherLock. The wheel is allocated on
+     * first use. mFdWheelTick is the next tick to sweep; mFdSweepTick
+     * the tick the sweep task is posted for, NoExpiry while the wheel
+     * is empty.
+     */
+    std::vector<std::vector<FdTimeoutEntry>> mFdWheel;
+    uint64_t                                 mFdWheelTick;
+    uint64_t                                 mFdSweepTick;
+    TaskHandle                               mFdSweepTask;
+    std::atomic<size_t>                      mFdTimeoutCount;
 
-    std::mutex mFunctionLock;
-    FunctionList mFunctions;
+    /*
+     * Loop-thread only: activity stamp of the current dispatch batch,
+     * and the sweep's bucket and expired list, reused between sweeps.
+     */
+    uint64_t                    mDispatchTimeMs;
+    std::vector<FdTimeoutEntry> mFdSweepBucket;
+    std::vector<FdTimeoutEvent> mFdExpired;
 
-    int mEpollFd;
-    int mPipe[2];
+    mutable std::mutex mTimerLock;
 
+    /*
+     * postDelayed()/postAt() pool, guarded by mTimerLock.
+     * A deque keeps entries in place while it grows. Declared before
+     * mTimers, which touches queued nodes when it is destroyed.
+     */
+    std::deque<DelayedTask> mDelayedTasks;
+    uint32_t                mFreeDelayedTask;
+
+    TimerHeap mTimers;
+
+    /*
+     * Loop-thread only. Reused to avoid an allocation per expiry batch.
+     */
+    TimerBatch mExpiredTimers;
+
+    static constexpr size_t PriorityCount = 3;
+    static constexpr size_t PhaseCount = 2;
+    static constexpr size_t NoLimit = static_cast<size_t>(-1);
+    static constexpr size_t NormalBatch = 32;
+    static constexpr size_t BackgroundBatch = 8;
+    static constexpr size_t TimerChunk = 32;
+
+    /*
+     * Indexed by Priority.
+     */
+    MpscQueue mFunctions[PriorityCount];
+
+    /*
+     * Nodes for post(); recycled by the loop thread.
+     */
+    PostedTaskPool mTaskPool;
+
+    InvokeSlotPool mInvokeSlots;
+
+    /*
+     * Indexed by Phase.
+     */
+    PhaseBudget mBudgets[PhaseCount];
+
+    std::unique_ptr<ILoopBackend> mBackend;
+
+    int mEventFd;
+
+    /*
+     * High-resolution mode only. Loop-thread state.
+     */
+    int      mTimerFd;
+    uint64_t mArmedExpiry;
+    bool     mHighResolution;
+
+    Histogram mTimerLateness;
+
+    std::atomic<uint64_t> mTimerWakeups;
+    std::atomic<uint64_t> mTimersCoalesced;
+
+    /*
+     * Opt-in instrumentation. mStatsActive is latched from mStatsEnabled
+     * at the start of each iteration (loop thread), so an iteration is
+     * measured either completely or not at all.
+     */
+    std::atomic<bool>     mStatsEnabled;
+    bool                  mStatsActive;
+    std::atomic<uint64_t> mIterations;
+
+    Histogram mFunctionTime;
+    Histogram mTimerTime;
+    Histogram mDispatchTime;
+    Histogram mSleepTime;
+    Histogram mCallbackTime;
+    Histogram mPostBatch;
+
+    /*
+     * Busy polling. mBusyPollNs is the configured budget bound; the rest
+     * is written by the loop thread only (stats counters are atomics so
+     * getStats() may read them).
+     */
+    std::atomic<uint64_t> mBusyPollNs;
+    std::atomic<uint64_t> mSpinBudgetNs;
+    uint64_t              mArrivalNs;
+    uint64_t              mWaitStart;
+    bool                  mSpinExhausted;
+
+    std::atomic<uint64_t> mBusySpinNs;
+    std::atomic<uint64_t> mBusySleepNs;
+    std::atomic<uint64_t> mBusyHits;
+    std::atomic<uint64_t> mBusyMisses;
+
+    /*
+     * Set by the first wakeup() since the last drain.
+     * Later callers skip the eventfd write.
+     */
+    std::atomic<bool> mWakeupPending;
     std::atomic<bool> mTerminated;
+
+    /*
+     * Thread running loop(); valid while mLooping is set.
+     */
+    pthread_t         mLoopThread;
+    std::atomic<bool> mLooping;
 };
+
+template <typename F>
+inline void MainLoop::post(F&& func, Priority priority)
+{
+    postTask(Closure(std::forward<F>(func)), priority);
+}
+
+template <typename F, typename R>
+inline Future<R> MainLoop::invoke(F&& func, Priority priority)
+{
+    if (isLoopThread())
+        return Future<R>::makeReady(func);
+
+    InvokeSlot* slot = mInvokeSlots.acquire();
+    PostedTask* task = slot->getTask();
+
+    task->mFunc = Closure([slot, func = std::forward<F>(func)]() mutable { slot->complete<R>(func); });
+    pushTask(task, priority);
+
+    return Future<R>(slot);
+}
+
+template <typename F>
+inline MainLoop::TaskHandle MainLoop::postDelayed(uint32_t msec, F&& func)
+{
+    return postTaskAt(Closure(std::forward<F>(func)),
+                      SysTime::getTickCountNs() + static_cast<uint64_t>(msec) * 1000 * 1000);
+}
+
+template <typename F>
+inline MainLoop::TaskHandle MainLoop::postAt(uint64_t deadlineMs, F&& func)
+{
+    return postTaskAt(Closure(std::forward<F>(func)), deadlineMs * 1000 * 1000);
+}
@@ -0,0 +1,109 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "MainLoopGroup.h"
+
+#include <unistd.h>
+
+#include "Log.h"
+
+MainLoopGroup::MainLoopGroup(size_t count, const std::string& name, int priority, bool pinToCores)
+    : mNext(0)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+
+    if (count == 0)
+        count = static_cast<size_t>(cpus);
+
+    mRunners.reserve(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int cpuid = pinToCores ? static_cast<int>(i % static_cast<size_t>(cpus)) : -1;
+
+        mRunners.emplace_back(new LoopRunner(name + std::to_string(i), priority, cpuid));
+    }
+}
+
+MainLoopGroup::~MainLoopGroup()
+{
+    stop();
+}
+
+bool MainLoopGroup::start()
+{
+    for (size_t i = 0; i < mRunners.size(); ++i)
+    {
+        if (!mRunners[i]->start())
+        {
+            LOGE("failed to start loop %zu", i);
+            stop();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MainLoopGroup::stop()
+{
+    for (std::unique_ptr<LoopRunner>& runner : mRunners)
+        runner->stop();
+}
+
+size_t MainLoopGroup::select(Policy policy)
+{
+    if (mRunners.empty())
+        return 0;
+
+    if (policy == Policy::RoundRobin)
+        return mNext.fetch_add(1, std::memory_order_relaxed) % mRunners.size();
+
+    size_t best = 0;
+    size_t bestLoad = static_cast<size_t>(-1);
+
+    for (size_t i = 0; i < mRunners.size(); ++i)
+    {
+        MainLoop& loop = mRunners[i]->mLoop;
+        /*
+         * Created rather than queued timers: a timer made by createTimer()
+         * counts before it is started, so timers created back to back
+         * spread over the loops.
+         */
+        const size_t load = loop.getFdWatcherCount() + loop.getCreatedTimerCount();
+
+        if (load < bestLoad)
+        {
+            best = i;
+            bestLoad = load;
+        }
+    }
+
+    return best;
+}
+
+bool MainLoopGroup::addFdWatcher(IFdWatcher* watcher, size_t& index, uint32_t events, Policy policy)
+{
+    if (mRunners.empty())
+        return false;
+
+    const size_t selected = select(policy);
+
+    if (!mRunners[selected]->mLoop.addFdWatcher(watcher, events))
+        return false;
+
+    index = selected;
+    return true;
+}
+
+Timer MainLoopGroup::createTimer(size_t& index, Policy policy)
+{
+    index = select(policy);
+
+    return mRunners[index]->mLoop.createTimer();
+}
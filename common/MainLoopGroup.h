@@ -0,0 +1,137 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "MainLoop.h"
+#include "WorkerThread.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * N shared-nothing MainLoops, each running on its own WorkerThread.
+ *
+ * Usage:
+ *
+ *   MainLoopGroup group(0, "NetLoop");   // one loop per online core
+ *   group.start();
+ *
+ *   size_t index = 0;
+ *
+ *   if (group.addFdWatcher(&conn, index, IFdWatcher::Readable,
+ *                          MainLoopGroup::Policy::LeastLoaded))
+ *       group.postTo(index, [&conn]() { conn.greet(); });
+ *   ...
+ *   group.at(index).removeFdWatcher(&conn);
+ *   group.stop();
+ *
+ * Watchers and timers stay on the loop they were assigned to;
+ * use the returned index (or at()) to reach that loop later.
+ */
+class MainLoopGroup
+{
+public:
+    enum class Policy
+    {
+        RoundRobin,
+        LeastLoaded  // fewest fd watchers + Timers created on it
+    };
+
+public:
+    /*
+     * count      : number of loops. 0 means one per online CPU.
+     * name       : thread name prefix. Threads are named "<name><index>".
+     * priority   : WorkerThread priority (> 0 means SCHED_FIFO).
+     * pinToCores : pin loop i to CPU (i % online CPUs).
+     */
+    explicit MainLoopGroup(size_t count = 0,
+                           const std::string& name = "Loop",
+                           int priority = -1,
+                           bool pinToCores = true);
+    ~MainLoopGroup();
+
+    MainLoopGroup(const MainLoopGroup&) = delete;
+    MainLoopGroup& operator=(const MainLoopGroup&) = delete;
+
+    bool start();
+
+    /*
+     * Terminates and joins all loops.
+     * A MainLoop cannot be restarted once terminated.
+     */
+    void stop();
+
+    size_t size() const;
+    MainLoop& at(size_t index);
+
+    size_t select(Policy policy = Policy::RoundRobin);
+
+    /*
+     * index: set to the loop the watcher was added to.
+     *
+     * @return false if MainLoop::addFdWatcher() failed; index is left
+     *         untouched then.
+     */
+    bool addFdWatcher(IFdWatcher* watcher,
+                      size_t& index,
+                      uint32_t events = IFdWatcher::Readable,
+                      Policy policy = Policy::RoundRobin);
+
+    /*
+     * index: set to the loop the timer was created on. Its handler runs
+     *        on that loop's thread.
+     */
+    Timer createTimer(size_t& index, Policy policy = Policy::RoundRobin);
+
+    template <typename F>
+    void postTo(size_t index, F&& func, MainLoop::Priority priority = MainLoop::Priority::Normal);
+
+private:
+    class LoopRunner : public IWorker
+    {
+    public:
+        LoopRunner(const std::string& name, int priority, int cpuid)
+            : mThread(name, priority, cpuid)
+        {
+        }
+
+        bool start() { return mThread.start(*this); }
+        void stop()  { mThread.stop(); }
+
+        MainLoop mLoop;
+
+    private:
+        void run() noexcept override { mLoop.loop(); }
+        void onPreStop() override    { mLoop.terminate(); }
+
+    private:
+        WorkerThread mThread;
+    };
+
+private:
+    std::vector<std::unique_ptr<LoopRunner>> mRunners;
+    std::atomic<size_t> mNext;
+};
+
+inline size_t MainLoopGroup::size() const
+{
+    return mRunners.size();
+}
+
+inline MainLoop& MainLoopGroup::at(size_t index)
+{
+    return mRunners[index]->mLoop;
+}
+
+template <typename F>
+inline void MainLoopGroup::postTo(size_t index, F&& func, MainLoop::Priority priority)
+{
+    mRunners[index]->mLoop.post(std::forward<F>(func), priority);
+}
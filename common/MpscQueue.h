@@ -0,0 +1,113 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include <atomic>
+
+class MpscQueue;
+
+/*
+ * Intrusive hook for MpscQueue.
+ */
+class MpscNode
+{
+private:
+    friend class MpscQueue;
+
+    std::atomic<MpscNode*> mNext { nullptr };
+};
+
+/*
+ * Intrusive lock-free multi-producer / single-consumer queue.
+ * (Dmitry Vyukov's non-blocking MPSC node queue)
+ *
+ * - push() : wait-free, any thread.
+ * - pop()  : lock-free, consumer thread only.
+ *
+ * pop() may return nullptr while a producer is in the middle of push().
+ * That producer always finishes with its own wakeup, so the consumer
+ * simply retries on its next pass.
+ *
+ * The queue never owns the nodes. Drain it before destroying.
+ */
+class MpscQueue
+{
+public:
+    MpscQueue()
+        : mHead(&mStub)
+        , mTail(&mStub)
+    {
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(MpscNode* node)
+    {
+        node->mNext.store(nullptr, std::memory_order_relaxed);
+
+        MpscNode* prev = mHead.exchange(node, std::memory_order_acq_rel);
+        prev->mNext.store(node, std::memory_order_release);
+    }
+
+    MpscNode* pop()
+    {
+        MpscNode* tail = mTail;
+        MpscNode* next = tail->mNext.load(std::memory_order_acquire);
+
+        if (tail == &mStub)
+        {
+            if (!next)
+                return nullptr;
+
+            mTail = next;
+            tail = next;
+            next = next->mNext.load(std::memory_order_acquire);
+        }
+
+        if (next)
+        {
+            mTail = next;
+            return tail;
+        }
+
+        MpscNode* head = mHead.load(std::memory_order_acquire);
+
+        /*
+         * A producer swapped mHead but has not linked mNext yet.
+         */
+        if (tail != head)
+            return nullptr;
+
+        push(&mStub);
+
+        next = tail->mNext.load(std::memory_order_acquire);
+
+        if (next)
+        {
+            mTail = next;
+            return tail;
+        }
+
+        return nullptr;
+    }
+
+    /*
+     * Consumer thread only.
+     */
+    bool empty() const
+    {
+        return mTail == &mStub &&
+               mStub.mNext.load(std::memory_order_acquire) == nullptr &&
+               mHead.load(std::memory_order_acquire) == &mStub;
+    }
+
+private:
+    std::atomic<MpscNode*> mHead;
+    MpscNode*              mTail;
+    MpscNode               mStub;
+};
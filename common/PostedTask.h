@@ -0,0 +1,190 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "Closure.h"
+#include "MpscQueue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <utility>
+
+class InvokeSlot;
+
+/*
+ * Node of MainLoop's post queues.
+ *
+ * MainLoop::post() takes one from the loop's PostedTaskPool and the loop
+ * hands it back after running; ThreadPool::post() allocates one per call.
+ * Nodes embedded in an InvokeSlot (mSlot set) are never deleted by the
+ * loop; their closure is moved out before it runs, since the owner may
+ * reuse the node as soon as the closure has published its result. One
+ * that never runs is handed to InvokeSlot::breakPromise().
+ */
+struct PostedTask : public MpscNode
+{
+    explicit PostedTask(InvokeSlot* slot)
+        : mSlot(slot)
+    {
+    }
+
+    explicit PostedTask(Closure&& func)
+        : mFunc(std::move(func))
+        , mSlot(nullptr)
+    {
+    }
+
+    Closure     mFunc;
+    InvokeSlot* mSlot;
+    /*
+     * PostedTaskPool free lists. Atomic because a producer popping the
+     * free stack may read it while the node is being reused.
+     */
+    std::atomic<PostedTask*> mNextFree { nullptr };
+};
+
+/*
+ * Recycles the nodes of one consumer's post queues, so a post does not
+ * allocate once the pool is warm.
+ *
+ * - acquire() : any thread, no lock. Pops one node off a Treiber stack
+ *               whose head carries a tag bumped on every change, so a
+ *               node popped and pushed back in between fails the CAS (ABA).
+ * - release() : consumer thread only. Nodes are kept locally and pushed
+ *               back ReturnBatch at a time with a single CAS.
+ *
+ * The tag shares one word with the pointer: the upper 16 bits on 64-bit
+ * targets, whose user-space addresses fit in 48 bits (x86-64, AArch64
+ * Linux), and the upper 32 bits of a 64-bit word on 32-bit ones.
+ * Nodes are only freed with the pool, so a stale head is safe to read.
+ *
+ * Grows to the peak number of nodes in flight, never shrinks.
+ */
+class PostedTaskPool
+{
+public:
+    static constexpr size_t ReturnBatch = 32;
+
+    PostedTaskPool()
+        : mFree(0)
+        , mLocal(nullptr)
+        , mLocalTail(nullptr)
+        , mLocalCount(0)
+    {
+    }
+
+    ~PostedTaskPool()
+    {
+        deleteList(pointerOf(mFree.load(std::memory_order_acquire)));
+        deleteList(mLocal);
+    }
+
+    PostedTaskPool(const PostedTaskPool&) = delete;
+    PostedTaskPool& operator=(const PostedTaskPool&) = delete;
+
+    PostedTask* acquire(Closure&& func)
+    {
+        Head head = mFree.load(std::memory_order_acquire);
+        PostedTask* task = nullptr;
+
+        while ((task = pointerOf(head)) != nullptr)
+        {
+            const Head next = pack(task->mNextFree.load(std::memory_order_relaxed), head);
+
+            if (mFree.compare_exchange_weak(head, next, std::memory_order_acquire,
+                                            std::memory_order_acquire))
+                break;
+        }
+
+        if (!task)
+            return new PostedTask(std::move(func));
+
+        task->mFunc = std::move(func);
+        return task;
+    }
+
+    /*
+     * task has run and its closure was reset.
+     */
+    void release(PostedTask* task)
+    {
+        task->mNextFree.store(mLocal, std::memory_order_relaxed);
+
+        if (!mLocal)
+            mLocalTail = task;
+
+        mLocal = task;
+
+        if (++mLocalCount < ReturnBatch)
+            return;
+
+        Head head = mFree.load(std::memory_order_relaxed);
+        Head next = 0;
+
+        do
+        {
+            mLocalTail->mNextFree.store(pointerOf(head), std::memory_order_relaxed);
+            next = pack(mLocal, head);
+        } while (!mFree.compare_exchange_weak(head, next, std::memory_order_release,
+                                              std::memory_order_relaxed));
+
+        mLocal = nullptr;
+        mLocalTail = nullptr;
+        mLocalCount = 0;
+    }
+
+private:
+    /*
+     * Tagged head of the free stack.
+     */
+    typedef uint64_t Head;
+
+    static constexpr unsigned TagShift = (sizeof(void*) == 8) ? 48 : 32;
+    static constexpr Head     PointerMask = (static_cast<Head>(1) << TagShift) - 1;
+
+    static_assert(sizeof(void*) == 8 || sizeof(void*) == 4, "PostedTaskPool: unsupported pointer size");
+
+    static PostedTask* pointerOf(Head head)
+    {
+        return reinterpret_cast<PostedTask*>(static_cast<uintptr_t>(head & PointerMask));
+    }
+
+    /*
+     * task as the new head, with the tag of prev bumped.
+     */
+    static Head pack(PostedTask* task, Head prev)
+    {
+        const Head tag = ((prev >> TagShift) + 1) << TagShift;
+
+        return tag | (static_cast<Head>(reinterpret_cast<uintptr_t>(task)) & PointerMask);
+    }
+
+    static void deleteList(PostedTask* task)
+    {
+        while (task)
+        {
+            PostedTask* next = task->mNextFree.load(std::memory_order_relaxed);
+
+            delete task;
+            task = next;
+        }
+    }
+
+private:
+    /*
+     * Shared by producers and the consumer.
+     */
+    alignas(64) std::atomic<Head> mFree;
+
+    /*
+     * Consumer side.
+     */
+    alignas(64) PostedTask* mLocal;
+    PostedTask*             mLocalTail;
+    size_t                  mLocalCount;
+};
@@ -23,6 +23,12 @@ uint64_t SysTime::getTickCountUs()
     return duration_cast<microseconds>(now.time_since_epoch()).count();
 }
 
+uint64_t SysTime::getTickCountNs()
+{
+    auto now = steady_clock::now();
+    return duration_cast<nanoseconds>(now.time_since_epoch()).count();
+}
+
 uint64_t SysTime::getCurrentTime()
 {
     auto now = system_clock::now();
@@ -32,6 +32,12 @@ public:
      */
     static uint64_t getTickCountUs();
 
+    /**
+     * @return current tick count (nanoseconds) after boot up
+     *         same time base as CLOCK_MONOTONIC.
+     */
+    static uint64_t getTickCountNs();
+
     /**
      * @return current time (milliseconds)
      */
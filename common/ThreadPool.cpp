@@ -0,0 +1,397 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "ThreadPool.h"
+
+#include "SysTime.h"
+#include "Log.h"
+
+#include <unistd.h>
+
+namespace
+{
+constexpr uint64_t NsPerUs = 1000ULL;
+
+/*
+ * Default spin budget before parking.
+ */
+constexpr uint64_t DefaultSpinNs = 20 * NsPerUs;
+
+/*
+ * Worker of the pool running on this thread, if any.
+ */
+thread_local const void* tPool = nullptr;
+thread_local void*       tWorker = nullptr;
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+}
+
+ThreadPool::ThreadPool(size_t count, const std::string& name, int priority, bool pinToCores)
+    : mInjectedCount(0)
+    , mSleepers(0)
+    , mSpinning(0)
+    , mWakeups(0)
+    , mSpinNs(DefaultSpinNs)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+
+    if (count == 0)
+        count = static_cast<size_t>(cpus);
+
+    mWorkers.reserve(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int cpuid = pinToCores ? static_cast<int>(i % static_cast<size_t>(cpus)) : -1;
+
+        mWorkers.emplace_back(new Worker(*this, i, name + std::to_string(i), priority, cpuid));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+
+    /*
+     * Posted after stop(): never run.
+     */
+    for (PostedTask* task : mInjected)
+    {
+        if (task->mSlot)
+            task->mSlot->breakPromise();
+        else
+            delete task;
+    }
+}
+
+bool ThreadPool::start()
+{
+    for (size_t i = 0; i < mWorkers.size(); ++i)
+    {
+        if (!mWorkers[i]->start())
+        {
+            LOGE("failed to start pool worker %zu", i);
+            stop();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ThreadPool::stop()
+{
+    for (std::unique_ptr<Worker>& worker : mWorkers)
+        worker->stop();
+}
+
+void ThreadPool::setSpin(uint32_t spinUs)
+{
+    mSpinNs.store(static_cast<uint64_t>(spinUs) * NsPerUs, std::memory_order_relaxed);
+}
+
+uint32_t ThreadPool::getSpin() const
+{
+    return static_cast<uint32_t>(mSpinNs.load(std::memory_order_relaxed) / NsPerUs);
+}
+
+bool ThreadPool::isPoolThread() const
+{
+    return tPool == this;
+}
+
+void ThreadPool::wakeAll()
+{
+    std::lock_guard<std::mutex> lock(mParkLock);
+    mParked.notify_all();
+}
+
+void ThreadPool::pushTask(PostedTask* task)
+{
+    if (tPool == this)
+    {
+        WorkStealingDeque<PostedTask>& deque = static_cast<Worker*>(tWorker)->mDeque;
+
+        /*
+         * This worker runs the task itself if nobody steals it, so a
+         * wakeup only adds parallelism and needs no fence. Only the
+         * first task of a burst tries one.
+         */
+        const bool wasEmpty = deque.empty();
+
+        deque.push(task);
+
+        if (wasEmpty)
+            wakeOne();
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mInjectLock);
+
+        mInjected.push_back(task);
+        mInjectedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*
+     * Dekker with park(): the task is published before mSpinning and
+     * mSleepers are read.
+     */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    wakeOne();
+}
+
+void ThreadPool::wakeOne()
+{
+    /*
+     * A spinning worker finds the task, and wakes the next one when it
+     * does. Otherwise claim the one spinner slot for the worker woken.
+     */
+    if (mSleepers.load(std::memory_order_relaxed) == 0)
+        return;
+
+    uint32_t spinning = 0;
+
+    if (!mSpinning.compare_exchange_strong(spinning, 1, std::memory_order_relaxed))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mParkLock);
+
+        if (mSleepers.load(std::memory_order_relaxed) > 0)
+        {
+            mSleepers.fetch_sub(1, std::memory_order_relaxed);
+            mWakeups++;
+            mParked.notify_one();
+            return;
+        }
+    }
+
+    mSpinning.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::stopSpinning()
+{
+    /*
+     * The last spinner found work: if more is queued, let another
+     * worker look for it.
+     */
+    if (mSpinning.fetch_sub(1, std::memory_order_acq_rel) == 1 && hasWork())
+        wakeOne();
+}
+
+void ThreadPool::runTask(PostedTask* task)
+{
+    if (task->mSlot)
+    {
+        /*
+         * The slot may be reused as soon as the result is published.
+         */
+        Closure func = std::move(task->mFunc);
+        func();
+    }
+    else
+    {
+        task->mFunc();
+        delete task;
+    }
+}
+
+PostedTask* ThreadPool::takeInjected(Worker& self)
+{
+    if (mInjectedCount.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(mInjectLock);
+
+    if (mInjected.empty())
+        return nullptr;
+
+    PostedTask* task = mInjected.front();
+    mInjected.pop_front();
+
+    /*
+     * Take a fair share more into the local deque, where the other
+     * workers can steal it without the lock.
+     */
+    size_t extra = mInjected.size() / mWorkers.size();
+
+    if (extra > InjectBatch)
+        extra = InjectBatch;
+
+    for (size_t i = 0; i < extra; ++i)
+    {
+        self.mDeque.push(mInjected.front());
+        mInjected.pop_front();
+    }
+
+    mInjectedCount.fetch_sub(extra + 1, std::memory_order_relaxed);
+
+    return task;
+}
+
+PostedTask* ThreadPool::steal(Worker& self)
+{
+    const size_t count = mWorkers.size();
+
+    if (count < 2)
+        return nullptr;
+
+    const size_t first = static_cast<size_t>(self.nextRandom() % count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        Worker& victim = *mWorkers[(first + i) % count];
+
+        if (&victim == &self)
+            continue;
+
+        if (PostedTask* task = victim.mDeque.steal())
+            return task;
+    }
+
+    return nullptr;
+}
+
+PostedTask* ThreadPool::findTask(Worker& self)
+{
+    if (PostedTask* task = self.mDeque.take())
+        return task;
+
+    if (PostedTask* task = takeInjected(self))
+        return task;
+
+    return steal(self);
+}
+
+bool ThreadPool::hasWork() const
+{
+    if (mInjectedCount.load(std::memory_order_relaxed) > 0)
+        return true;
+
+    for (const std::unique_ptr<Worker>& worker : mWorkers)
+    {
+        if (!worker->mDeque.empty())
+            return true;
+    }
+
+    return false;
+}
+
+bool ThreadPool::park(Worker& self, bool spinning)
+{
+    std::unique_lock<std::mutex> lock(mParkLock);
+
+    mSleepers.fetch_add(1, std::memory_order_relaxed);
+
+    if (spinning)
+        mSpinning.fetch_sub(1, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (hasWork() || !self.shouldRun())
+    {
+        mSleepers.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    mParked.wait(lock, [this, &self]() { return mWakeups > 0 || !self.shouldRun(); });
+
+    /*
+     * Woken by a producer, which already took us off mSleepers and
+     * counted us as spinning.
+     */
+    if (mWakeups > 0)
+    {
+        mWakeups--;
+        return true;
+    }
+
+    mSleepers.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+void ThreadPool::run(Worker& self)
+{
+    tPool = this;
+    tWorker = &self;
+
+    /*
+     * Counted in mSpinning.
+     */
+    bool spinning = false;
+
+    while (true)
+    {
+        if (PostedTask* task = findTask(self))
+        {
+            if (spinning)
+            {
+                spinning = false;
+                stopSpinning();
+            }
+
+            runTask(task);
+            continue;
+        }
+
+        /*
+         * Stopping: leave once nothing is found, so queued work is done.
+         */
+        if (!self.shouldRun())
+            break;
+
+        const uint64_t spinNs = mSpinNs.load(std::memory_order_relaxed);
+        PostedTask* task = nullptr;
+
+        if (spinNs > 0)
+        {
+            if (!spinning)
+            {
+                spinning = true;
+                mSpinning.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            const uint64_t deadline = SysTime::getTickCountNs() + spinNs;
+
+            do
+            {
+                for (int i = 0; i < 16; ++i)
+                    cpuRelax();
+
+                task = findTask(self);
+            } while (!task && self.shouldRun() && SysTime::getTickCountNs() < deadline);
+        }
+
+        if (task)
+        {
+            spinning = false;
+            stopSpinning();
+
+            runTask(task);
+            continue;
+        }
+
+        spinning = park(self, spinning);
+    }
+
+    if (spinning)
+        mSpinning.fetch_sub(1, std::memory_order_relaxed);
+
+    tPool = nullptr;
+    tWorker = nullptr;
+}
@@ -0,0 +1,227 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "Closure.h"
+#include "Future.h"
+#include "PostedTask.h"
+#include "WorkStealingDeque.h"
+#include "WorkerThread.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Work-stealing thread pool for short tasks.
+ *
+ *   ThreadPool pool(4, "Pool");
+ *   pool.start();
+ *
+ *   Future<int> sum = pool.submit([&]() { return compute(); });
+ *   pool.post([]() { cleanup(); });
+ *
+ *   use(sum.get());
+ *
+ * Each worker has a Chase-Lev deque. Tasks submitted from a worker go to
+ * its own deque (LIFO, cache-warm); tasks from other threads go to a
+ * shared injection queue. An idle worker takes from its deque, then the
+ * injection queue, then steals from random victims (FIFO end). With
+ * nothing found it spins for the spin budget, then parks.
+ *
+ * Wakeups follow Go's scheduler. A parked worker is woken only when no
+ * worker is spinning, and a woken worker spins. The last spinner to
+ * find work wakes the next one if more is queued. A worker pushing to
+ * its own deque only tries a wakeup when the deque was empty, so a fork
+ * of many tasks wakes one worker, and the rest come up one by one.
+ *
+ * Tasks must not block on other tasks of the same pool unless enough
+ * workers are left to run them.
+ */
+class ThreadPool
+{
+public:
+    /*
+     * count      : number of workers. 0 means one per online CPU.
+     * name       : thread name prefix. Threads are named "<name><index>".
+     * priority   : WorkerThread priority (> 0 means SCHED_FIFO).
+     * pinToCores : pin worker i to CPU (i % online CPUs).
+     */
+    explicit ThreadPool(size_t count = 0,
+                        const std::string& name = "Pool",
+                        int priority = -1,
+                        bool pinToCores = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    bool start();
+
+    /*
+     * Runs what is queued, then joins the workers. Tasks posted after
+     * stop() are dropped when the pool is destroyed; their Futures
+     * are broken (see Future).
+     */
+    void stop();
+
+    size_t size() const;
+
+    /*
+     * Runs func on a worker. Thread-safe. One allocation per call.
+     */
+    template <typename F>
+    void post(F&& func);
+
+    /*
+     * Runs func on a worker and hands its result back through a Future
+     * backed by a pooled slot: no allocation per call once warm (results
+     * up to InvokeSlot::InlineSize bytes). Thread-safe.
+     */
+    template <typename F, typename R = typename std::decay<typename std::invoke_result<F&>::type>::type>
+    Future<R> submit(F&& func);
+
+    /*
+     * How long an idle worker keeps looking for work before it parks.
+     * 0 parks at once; right for oversubscribed CPUs. Default 20 us.
+     * Safe from any thread.
+     */
+    void     setSpin(uint32_t spinUs);
+    uint32_t getSpin() const;
+
+    /*
+     * true on one of this pool's workers.
+     */
+    bool isPoolThread() const;
+
+private:
+    class Worker : public IWorker
+    {
+    public:
+        Worker(ThreadPool& pool, size_t index, const std::string& name, int priority, int cpuid)
+            : mPool(pool)
+            , mIndex(index)
+            , mRandom(0x9e3779b97f4a7c15ULL * (index + 1))
+            , mThread(name, priority, cpuid)
+        {
+        }
+
+        bool start() { return mThread.start(*this); }
+        void stop()  { mThread.stop(); }
+
+        bool shouldRun() const { return mThread.shouldRun(); }
+
+        /*
+         * xorshift64, for picking steal victims.
+         */
+        uint64_t nextRandom()
+        {
+            mRandom ^= mRandom << 13;
+            mRandom ^= mRandom >> 7;
+            mRandom ^= mRandom << 17;
+            return mRandom;
+        }
+
+        ThreadPool& mPool;
+        size_t      mIndex;
+
+        WorkStealingDeque<PostedTask> mDeque;
+
+    private:
+        void run() noexcept override { mPool.run(*this); }
+        void onPreStop() override    { mPool.wakeAll(); }
+
+    private:
+        uint64_t     mRandom;
+        WorkerThread mThread;
+    };
+
+    void run(Worker& self);
+    void wakeAll();
+
+    void pushTask(PostedTask* task);
+    void runTask(PostedTask* task);
+
+    PostedTask* findTask(Worker& self);
+    PostedTask* takeInjected(Worker& self);
+    PostedTask* steal(Worker& self);
+
+    void wakeOne();
+    void stopSpinning();
+
+    bool hasWork() const;
+
+    /*
+     * @return true if woken by a producer; the worker then spins.
+     */
+    bool park(Worker& self, bool spinning);
+
+private:
+    static constexpr size_t InjectBatch = 32;
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+
+    /*
+     * Tasks from outside the pool. mInjectedCount lets idle workers
+     * check it without the lock.
+     */
+    std::mutex               mInjectLock;
+    std::deque<PostedTask*>  mInjected;
+    std::atomic<size_t>      mInjectedCount;
+
+    /*
+     * Parking. A producer reads mSpinning and mSleepers after publishing
+     * its task, and a worker re-checks for work after counting itself
+     * in as a sleeper and out as a spinner, so one of them always sees
+     * the other. mWakeups: sleepers claimed by a producer and not yet
+     * up, guarded by mParkLock.
+     */
+    std::mutex              mParkLock;
+    std::condition_variable mParked;
+    std::atomic<uint32_t>   mSleepers;
+    std::atomic<uint32_t>   mSpinning;
+    uint32_t                mWakeups;
+
+    std::atomic<uint64_t> mSpinNs;
+
+    InvokeSlotPool mInvokeSlots;
+};
+
+inline size_t ThreadPool::size() const
+{
+    return mWorkers.size();
+}
+
+template <typename F>
+inline void ThreadPool::post(F&& func)
+{
+    Closure closure(std::forward<F>(func));
+
+    if (!closure)
+        return;
+
+    pushTask(new PostedTask(std::move(closure)));
+}
+
+template <typename F, typename R>
+inline Future<R> ThreadPool::submit(F&& func)
+{
+    InvokeSlot* slot = mInvokeSlots.acquire();
+    PostedTask* task = slot->getTask();
+
+    task->mFunc = Closure([slot, func = std::forward<F>(func)]() mutable { slot->complete<R>(func); });
+    pushTask(task);
+
+    return Future<R>(slot);
+}
@@ -10,12 +10,18 @@
 #include "SysTime.h"
 #include "Log.h"
 
-uint64_t Timer::makeExpiry(uint32_t interval)
+namespace
 {
-    if (interval == Infinite)
+constexpr uint64_t NsPerUs = 1000ULL;
+constexpr uint64_t NsPerMs = 1000ULL * 1000ULL;
+}
+
+uint64_t Timer::makeExpiry(uint64_t intervalNs)
+{
+    if (intervalNs == InfiniteNs)
         return static_cast<uint64_t>(-1);
 
-    return SysTime::getTickCountMs() + interval;
+    return SysTime::getTickCountNs() + intervalNs;
 }
 
 Timer::Timer(MainLoop& loop)
@@ -23,10 +29,16 @@ Timer::Timer(MainLoop& loop)
     , mState(State::Stopped)
     , mStopRequested(false)
     , mExpiry(static_cast<uint64_t>(-1))
+    , mSlackNs(0)
+    , mOverrunCount(0)
     , mHandler(nullptr)
-    , mInterval(Infinite)
+    , mIntervalNs(InfiniteNs)
     , mRepeat(false)
+    , mFixedRate(false)
+    , mOverrunPolicy(Overrun::Skip)
+    , mCatchUpLimit(1)
 {
+    mLoop.mCreatedTimerCount.fetch_add(1, std::memory_order_relaxed);
 }
 
 Timer::~Timer()
@@ -39,39 +51,46 @@ Timer::~Timer()
      * - destroying this Timer's owner from its own callback.
      */
     stopAndWait();
+
+    mLoop.mCreatedTimerCount.fetch_sub(1, std::memory_order_relaxed);
 }
 
 void Timer::setHandler(ITimerHandler* handler)
 {
-    std::lock_guard<std::mutex> lock(mConfigLock);
-    mHandler = handler;
+    mHandler.store(handler, std::memory_order_release);
 }
 
 void Timer::start(uint32_t msec, bool repeat)
+{
+    startNs((msec == Infinite) ? InfiniteNs : msec * NsPerMs, repeat);
+}
+
+void Timer::startUs(uint32_t usec, bool repeat)
+{
+    startNs((usec == Infinite) ? InfiniteNs : usec * NsPerUs, repeat);
+}
+
+void Timer::startNs(uint64_t intervalNs, bool repeat)
 {
     std::lock_guard<std::mutex> controlLock(mControlLock);
 
     /*
      * start() is intentionally strong:
      * stop completely first, then schedule again.
-     *
-     * Do not call this on THIS timer from its callback.
      */
     stopAndWait();
 
-    if (msec == Infinite)
+    if (intervalNs == InfiniteNs)
     {
         LOGE("Timer::start() ignored. interval is Infinite.");
         return;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(mConfigLock);
+    mIntervalNs.store(intervalNs, std::memory_order_relaxed);
+    mRepeat.store(repeat, std::memory_order_relaxed);
+    mExpiry.store(makeExpiry(intervalNs), std::memory_order_release);
 
-        mInterval = msec;
-        mRepeat = repeat;
-        mExpiry.store(makeExpiry(mInterval), std::memory_order_release);
-    }
+    mOverrunCount.store(0, std::memory_order_relaxed);
 
     mStopRequested.store(false, std::memory_order_release);
     mState.store(State::Queued, std::memory_order_release);
@@ -81,16 +100,7 @@ void Timer::start(uint32_t msec, bool repeat)
 
 void Timer::restart()
 {
-    uint32_t interval = Infinite;
-    bool repeat = false;
-
-    {
-        std::lock_guard<std::mutex> lock(mConfigLock);
-        interval = mInterval;
-        repeat = mRepeat;
-    }
-
-    start(interval, repeat);
+    startNs(mIntervalNs.load(std::memory_order_relaxed), mRepeat.load(std::memory_order_relaxed));
 }
 
 void Timer::stop()
@@ -130,6 +140,10 @@ void Timer::stop()
                  * Do not touch MainLoop's timer list here.
                  */
                 mStopRequested.store(true, std::memory_order_release);
+
+                if (mLoop.isLoopThread())
+                    dropFromLoop();
+
                 return;
         }
     }
@@ -175,12 +189,19 @@ void Timer::stopAndWait()
                 /*
                  * MainLoop holds this Timer pointer outside the timer-list
                  * lock. Request stop and wait until MainLoop finishes using it.
-                 *
-                 * Calling this from this timer's own callback will deadlock.
-                 * That usage is forbidden by ITimerHandler contract.
                  */
                 mStopRequested.store(true, std::memory_order_release);
 
+                /*
+                 * On the loop thread, MainLoop cannot finish with it while
+                 * we wait here.
+                 */
+                if (mLoop.isLoopThread())
+                {
+                    dropFromLoop();
+                    return;
+                }
+
                 std::unique_lock<std::mutex> lock(mWaitLock);
                 mStateChanged.wait(lock, [this]() {
                     State s = mState.load(std::memory_order_acquire);
@@ -200,26 +221,79 @@ void Timer::stopAndWait()
 
 void Timer::setInterval(uint32_t msec)
 {
-    std::lock_guard<std::mutex> lock(mConfigLock);
-    mInterval = msec;
+    mIntervalNs.store((msec == Infinite) ? InfiniteNs : msec * NsPerMs, std::memory_order_relaxed);
 }
 
 uint32_t Timer::getInterval() const
 {
-    std::lock_guard<std::mutex> lock(mConfigLock);
-    return mInterval;
+    const uint64_t intervalNs = mIntervalNs.load(std::memory_order_relaxed);
+
+    if (intervalNs == InfiniteNs)
+        return Infinite;
+
+    return static_cast<uint32_t>(intervalNs / NsPerMs);
+}
+
+void Timer::setIntervalUs(uint32_t usec)
+{
+    mIntervalNs.store((usec == Infinite) ? InfiniteNs : usec * NsPerUs, std::memory_order_relaxed);
+}
+
+uint32_t Timer::getIntervalUs() const
+{
+    const uint64_t intervalNs = mIntervalNs.load(std::memory_order_relaxed);
+
+    if (intervalNs == InfiniteNs)
+        return Infinite;
+
+    return static_cast<uint32_t>(intervalNs / NsPerUs);
+}
+
+void Timer::setSlack(uint32_t msec)
+{
+    mSlackNs.store(msec * NsPerMs, std::memory_order_relaxed);
+}
+
+uint32_t Timer::getSlack() const
+{
+    return static_cast<uint32_t>(mSlackNs.load(std::memory_order_relaxed) / NsPerMs);
+}
+
+void Timer::setSlackUs(uint32_t usec)
+{
+    mSlackNs.store(usec * NsPerUs, std::memory_order_relaxed);
+}
+
+uint32_t Timer::getSlackUs() const
+{
+    return static_cast<uint32_t>(mSlackNs.load(std::memory_order_relaxed) / NsPerUs);
+}
+
+void Timer::setFixedRate(bool enable, Overrun policy, uint32_t catchUpLimit)
+{
+    mOverrunPolicy.store(policy, std::memory_order_relaxed);
+    mCatchUpLimit.store((catchUpLimit > 0) ? catchUpLimit : 1, std::memory_order_relaxed);
+    mFixedRate.store(enable, std::memory_order_relaxed);
+}
+
+bool Timer::isFixedRate() const
+{
+    return mFixedRate.load(std::memory_order_relaxed);
+}
+
+uint64_t Timer::getOverrunCount() const
+{
+    return mOverrunCount.load(std::memory_order_relaxed);
 }
 
 void Timer::setRepeat(bool repeat)
 {
-    std::lock_guard<std::mutex> lock(mConfigLock);
-    mRepeat = repeat;
+    mRepeat.store(repeat, std::memory_order_relaxed);
 }
 
 bool Timer::getRepeat() const
 {
-    std::lock_guard<std::mutex> lock(mConfigLock);
-    return mRepeat;
+    return mRepeat.load(std::memory_order_relaxed);
 }
 
 bool Timer::isRunning() const
@@ -227,11 +301,34 @@ bool Timer::isRunning() const
     return mState.load(std::memory_order_acquire) != State::Stopped;
 }
 
+void Timer::dropFromLoop()
+{
+    /*
+     * Called on the loop thread only, so the timer is in the expiry batch
+     * MainLoop is running right now, and not in its heap.
+     */
+    mLoop.dropExpiredTimer(this);
+
+    mState.store(State::Stopped, std::memory_order_release);
+    mStateChanged.notify_all();
+}
+
 uint64_t Timer::getExpiryFromLoop() const
 {
     return mExpiry.load(std::memory_order_acquire);
 }
 
+uint64_t Timer::getDeadlineFromLoop() const
+{
+    const uint64_t expiry = mExpiry.load(std::memory_order_acquire);
+    const uint64_t slack = mSlackNs.load(std::memory_order_relaxed);
+
+    if (expiry > static_cast<uint64_t>(-1) - slack)
+        return static_cast<uint64_t>(-1);
+
+    return expiry + slack;
+}
+
 bool Timer::tryBeginExecuteFromLoop()
 {
     State expected = State::Queued;
@@ -251,13 +348,28 @@ bool Timer::tryBeginExecuteFromLoop()
 
 bool Timer::executeFromLoop()
 {
-    ITimerHandler* handler = nullptr;
-
+    /*
+     * Stopped from another thread after MainLoop took it into the batch:
+     * do not call the handler.
+     */
+    if (mStopRequested.load(std::memory_order_acquire))
     {
-        std::lock_guard<std::mutex> lock(mConfigLock);
-        handler = mHandler;
+        State expected = State::Executing;
+
+        if (mState.compare_exchange_strong(
+                expected,
+                State::Stopped,
+                std::memory_order_acq_rel,
+                std::memory_order_acquire))
+        {
+            mStateChanged.notify_all();
+        }
+
+        return false;
     }
 
+    ITimerHandler* handler = mHandler.load(std::memory_order_acquire);
+
     bool keepByHandler = false;
 
     if (handler)
@@ -265,79 +377,145 @@ bool Timer::executeFromLoop()
         keepByHandler = handler->onTimerExpired(*this);
     }
 
-    uint32_t interval = Infinite;
-    bool repeat = false;
-    bool hasHandler = false;
-
-    {
-        std::lock_guard<std::mutex> lock(mConfigLock);
-
-        interval = mInterval;
-        repeat = mRepeat;
-        hasHandler = (mHandler != nullptr);
-    }
+    const uint64_t intervalNs = mIntervalNs.load(std::memory_order_relaxed);
+    const bool repeat = mRepeat.load(std::memory_order_relaxed);
+    const bool hasHandler = mHandler.load(std::memory_order_acquire) != nullptr;
 
     const bool keep =
         !mStopRequested.load(std::memory_order_acquire) &&
         keepByHandler &&
         repeat &&
-        interval != Infinite &&
+        intervalNs != InfiniteNs &&
         hasHandler;
 
-    if (!keep)
-    {
-        mState.store(State::Stopped, std::memory_order_release);
-        mStateChanged.notify_all();
-        return false;
-    }
-
     /*
-     * Embedded-safe default:
-     * next expiry is based on current time.
+     * The handler may have stopped or restarted this timer; then it is no
+     * longer Executing and the state it set stands.
      *
-     * This avoids catch-up storms when the system was delayed.
+     * Otherwise the new expiry is assigned by beginRequeueFromLoop(), once
+     * MainLoop has finished the whole expired batch.
      */
-    mExpiry.store(makeExpiry(interval), std::memory_order_release);
+    State expected = State::Executing;
+
+    if (!mState.compare_exchange_strong(
+            expected,
+            keep ? State::RequeuePending : State::Stopped,
+            std::memory_order_acq_rel,
+            std::memory_order_acquire))
+    {
+        return false;
+    }
 
-    mState.store(State::RequeuePending, std::memory_order_release);
     mStateChanged.notify_all();
 
-    return true;
+    return keep;
 }
 
-void Timer::requeueFromLoop()
+void Timer::deferExecuteFromLoop()
+{
+    State expected = State::Executing;
+
+    mState.compare_exchange_strong(
+        expected,
+        State::RequeuePending,
+        std::memory_order_acq_rel,
+        std::memory_order_acquire);
+}
+
+bool Timer::beginRequeueFromLoop(uint64_t now, bool reschedule)
 {
     State state = mState.load(std::memory_order_acquire);
 
     if (state != State::RequeuePending)
     {
         mStateChanged.notify_all();
-        return;
+        return false;
     }
 
     if (mStopRequested.load(std::memory_order_acquire))
     {
         mState.store(State::Stopped, std::memory_order_release);
         mStateChanged.notify_all();
-        return;
+        return false;
     }
 
+    if (!reschedule)
+        return true;
+
+    const uint64_t intervalNs = mIntervalNs.load(std::memory_order_relaxed);
+    const bool fixedRate = mFixedRate.load(std::memory_order_relaxed);
+
+    /*
+     * Embedded-safe default:
+     * next expiry is based on current time.
+     *
+     * This avoids catch-up storms when the system was delayed.
+     * Fixed-rate timers opt into catch-up through their overrun policy.
+     */
+    if (intervalNs == InfiniteNs)
+        mExpiry.store(static_cast<uint64_t>(-1), std::memory_order_release);
+    else if (fixedRate)
+        mExpiry.store(getFixedRateExpiry(now, intervalNs), std::memory_order_release);
+    else
+        mExpiry.store(now + intervalNs, std::memory_order_release);
+
     /*
-     * Keep RequeuePending while inserting into MainLoop.
+     * Keep RequeuePending while MainLoop inserts this timer.
      * This prevents stopAndWait() from returning while MainLoop still holds
      * this Timer pointer.
      */
-    mLoop.addTimer(this);
+    return true;
+}
 
-    if (mStopRequested.load(std::memory_order_acquire))
+uint64_t Timer::getFixedRateExpiry(uint64_t now, uint64_t intervalNs)
+{
+    uint64_t expiry = mExpiry.load(std::memory_order_acquire) + intervalNs;
+
+    if (expiry > now)
+        return expiry;
+
+    const Overrun policy = mOverrunPolicy.load(std::memory_order_relaxed);
+    const uint32_t catchUpLimit = mCatchUpLimit.load(std::memory_order_relaxed);
+
+    /*
+     * Ticks on the grid that are already due, including this one.
+     */
+    const uint64_t behind = (now - expiry) / intervalNs + 1;
+
+    uint64_t dropped = 0;
+
+    switch (policy)
     {
-        mLoop.removeTimer(this);
+        case Overrun::Skip:
+            dropped = behind;
+            break;
+
+        case Overrun::FireOnce:
+            dropped = behind - 1;
+            break;
 
+        case Overrun::CatchUp:
+            dropped = (behind > catchUpLimit) ? behind - catchUpLimit : 0;
+            break;
+    }
+
+    if (dropped > 0)
+        mOverrunCount.fetch_add(dropped, std::memory_order_relaxed);
+
+    return expiry + dropped * intervalNs;
+}
+
+bool Timer::endRequeueFromLoop()
+{
+    if (mStopRequested.load(std::memory_order_acquire))
+    {
         mState.store(State::Stopped, std::memory_order_release);
         mStateChanged.notify_all();
-        return;
+        return false;
     }
 
     mState.store(State::Queued, std::memory_order_release);
     mStateChanged.notify_all();
+
+    return true;
 }
@@ -6,6 +6,8 @@
  */
 #pragma once
 
+#include "TimerHeap.h"
+
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
@@ -30,8 +32,11 @@ public:
      *   For Timer, it is called from MainLoop.
      *   For TimerTask, it may be called from the timer task thread.
      *
-     * - Do not call start(), restart(), stop(), stopAndWait(), or destroy
-     *   on THIS timer from this callback.
+     * - Timer (MainLoop) and ServiceTimer: start(), restart(), stop() (and
+     *   Timer's stopAndWait()) on THIS timer are allowed from this
+     *   callback; the return value is then ignored.
+     *   TimerThread: do not call them on THIS timer from this callback;
+     *   they join the thread running it.
      *
      * - Starting/stopping/restarting OTHER timers is allowed.
      *
@@ -80,7 +85,19 @@ public:
 
 class MainLoop;
 
-class Timer : public ITimer
+/*
+ * Timer run by a MainLoop; made by MainLoop::createTimer().
+ *
+ * Thread-safe. From another thread, stop() and start() wait until a
+ * callback of this timer that is running has returned.
+ *
+ * On the loop thread the fast path only removes that wait and the loop
+ * wakeup, not the locks: start()/stop() still take mControlLock, and
+ * MainLoop's timer lock for the heap change. Other threads may control
+ * the same timer or post delayed tasks at any time. Uncontended, both
+ * locks cost no syscall.
+ */
+class Timer : public ITimer, private TimerHeapNode
 {
 public:
     static constexpr uint32_t Infinite = static_cast<uint32_t>(-1);
@@ -108,6 +125,58 @@ public:
 
     bool isRunning() const override;
 
+    /*
+     * Microsecond variants of start()/setInterval()/getInterval().
+     *
+     * Sub-millisecond intervals are only honored precisely when the
+     * MainLoop runs in high-resolution mode. See MainLoop::setHighResolution().
+     */
+    void startUs(uint32_t usec, bool repeat);
+
+    void setIntervalUs(uint32_t usec);
+    uint32_t getIntervalUs() const;
+
+    /*
+     * Slack: how late the timer may fire. MainLoop keys the timer by
+     * expiry + slack and, when it wakes up anyway, also runs timers whose
+     * expiry has passed but whose slack has not, so timers with
+     * overlapping windows share one wakeup. A timer never fires early.
+     *
+     * Default 0 (exact). Applies from the next expiry.
+     */
+    void setSlack(uint32_t msec);
+    uint32_t getSlack() const;
+
+    void setSlackUs(uint32_t usec);
+    uint32_t getSlackUs() const;
+
+    /*
+     * What a fixed-rate timer does with ticks it fell behind on.
+     */
+    enum class Overrun : uint8_t
+    {
+        Skip,       // drop them, fire at the next tick on the grid
+        FireOnce,   // fire one at once, drop the rest
+        CatchUp,    // fire them back to back, at most catchUpLimit
+    };
+
+    /*
+     * Fixed-rate repeat: expiries stay on the start + n * interval grid,
+     * so the callback's run time does not accumulate as drift.
+     * Default is fixed-delay: the next expiry is the end of the expiry
+     * batch plus the interval.
+     *
+     * Applies from the next expiry.
+     */
+    void setFixedRate(bool enable, Overrun policy = Overrun::Skip, uint32_t catchUpLimit = 1);
+    bool isFixedRate() const;
+
+    /*
+     * Ticks dropped by the overrun policy since start().
+     * Safe to call from the handler.
+     */
+    uint64_t getOverrunCount() const;
+
 private:
     friend class MainLoop;
 
@@ -122,20 +191,52 @@ private:
     };
 
 private:
+    static constexpr uint64_t InfiniteNs = static_cast<uint64_t>(-1);
+
     /*
      * MainLoop-only methods.
      * Hidden from ITimer users.
+     *
+     * Expiry is in SysTime::getTickCountNs() time base.
      */
     uint64_t getExpiryFromLoop() const;
 
+    /*
+     * Expiry + slack: the heap key, the latest time the timer may fire.
+     */
+    uint64_t getDeadlineFromLoop() const;
+
     bool tryBeginExecuteFromLoop();
     bool executeFromLoop();
-    void requeueFromLoop();
+
+    /*
+     * Taken for execution but not run (MainLoop ran out of its timer
+     * budget). Executing -> RequeuePending, keeping the expiry.
+     */
+    void deferExecuteFromLoop();
+
+    /*
+     * Called by MainLoop with its timer lock held.
+     * begin: assign the next expiry (now + interval) if reschedule is set,
+     *        else keep the current one. false means do not insert.
+     * end  : after insertion. false means MainLoop must remove it again.
+     */
+    bool beginRequeueFromLoop(uint64_t now, bool reschedule);
+    bool endRequeueFromLoop();
 
 private:
+    void startNs(uint64_t intervalNs, bool repeat);
     void stopAndWait();
 
-    static uint64_t makeExpiry(uint32_t interval);
+    /*
+     * Stop while Executing/RequeuePending, called on the loop thread:
+     * MainLoop forgets the timer instead of being waited for.
+     */
+    void dropFromLoop();
+
+    static uint64_t makeExpiry(uint64_t intervalNs);
+
+    uint64_t getFixedRateExpiry(uint64_t now, uint64_t intervalNs);
 
 private:
     MainLoop& mLoop;
@@ -152,6 +253,8 @@ private:
     std::atomic<State>    mState;
     std::atomic<bool>     mStopRequested;
     std::atomic<uint64_t> mExpiry;
+    std::atomic<uint64_t> mSlackNs;
+    std::atomic<uint64_t> mOverrunCount;
 
     /*
      * Used for waiting until MainLoop no longer touches this Timer.
@@ -160,11 +263,14 @@ private:
     std::condition_variable mStateChanged;
 
     /*
-     * Handler and configuration.
+     * Handler and configuration. Each field is read on its own, so
+     * plain atomics do; no lock on the loop's execution path.
      */
-    mutable std::mutex mConfigLock;
+    std::atomic<ITimerHandler*> mHandler;
+    std::atomic<uint64_t>       mIntervalNs;
+    std::atomic<bool>           mRepeat;
 
-    ITimerHandler* mHandler;
-    uint32_t       mInterval;
-    bool           mRepeat;
+    std::atomic<bool>     mFixedRate;
+    std::atomic<Overrun>  mOverrunPolicy;
+    std::atomic<uint32_t> mCatchUpLimit;
 };
@@ -0,0 +1,148 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "TimerHeap.h"
+
+TimerHeap::~TimerHeap()
+{
+    for (Entry& entry : mEntries)
+        entry.node->mHeapIndex = TimerHeapNode::InvalidIndex;
+}
+
+bool TimerHeap::push(TimerHeapNode* node, uint64_t expiry)
+{
+    if (!node || node->isQueued())
+        return false;
+
+    mEntries.push_back(Entry { expiry, mNextSeq++, node });
+    node->mHeapIndex = static_cast<uint32_t>(mEntries.size() - 1);
+
+    siftUp(mEntries.size() - 1);
+    return true;
+}
+
+bool TimerHeap::remove(TimerHeapNode* node)
+{
+    if (!node || !node->isQueued())
+        return false;
+
+    const size_t index = node->mHeapIndex;
+
+    if (index >= mEntries.size() || mEntries[index].node != node)
+        return false;
+
+    removeAt(index);
+    return true;
+}
+
+TimerHeapNode* TimerHeap::pop()
+{
+    if (mEntries.empty())
+        return nullptr;
+
+    TimerHeapNode* node = mEntries.front().node;
+    removeAt(0);
+
+    return node;
+}
+
+TimerHeapNode* TimerHeap::top() const
+{
+    if (mEntries.empty())
+        return nullptr;
+
+    return mEntries.front().node;
+}
+
+uint64_t TimerHeap::topExpiry() const
+{
+    if (mEntries.empty())
+        return static_cast<uint64_t>(-1);
+
+    return mEntries.front().expiry;
+}
+
+void TimerHeap::removeAt(size_t index)
+{
+    mEntries[index].node->mHeapIndex = TimerHeapNode::InvalidIndex;
+
+    const size_t last = mEntries.size() - 1;
+
+    if (index != last)
+    {
+        const Entry moved = mEntries[last];
+        mEntries.pop_back();
+
+        place(index, moved);
+
+        /*
+         * The moved entry may belong either above or below its new slot.
+         */
+        if (index > 0 && before(moved, mEntries[(index - 1) / Arity]))
+            siftUp(index);
+        else
+            siftDown(index);
+
+        return;
+    }
+
+    mEntries.pop_back();
+}
+
+void TimerHeap::siftUp(size_t index)
+{
+    const Entry entry = mEntries[index];
+
+    while (index > 0)
+    {
+        const size_t parent = (index - 1) / Arity;
+
+        if (!before(entry, mEntries[parent]))
+            break;
+
+        place(index, mEntries[parent]);
+        index = parent;
+    }
+
+    place(index, entry);
+}
+
+void TimerHeap::siftDown(size_t index)
+{
+    const Entry entry = mEntries[index];
+    const size_t count = mEntries.size();
+
+    while (true)
+    {
+        const size_t first = index * Arity + 1;
+
+        if (first >= count)
+            break;
+
+        size_t smallest = first;
+        const size_t end = (first + Arity < count) ? first + Arity : count;
+
+        for (size_t child = first + 1; child < end; ++child)
+        {
+            if (before(mEntries[child], mEntries[smallest]))
+                smallest = child;
+        }
+
+        if (!before(mEntries[smallest], entry))
+            break;
+
+        place(index, mEntries[smallest]);
+        index = smallest;
+    }
+
+    place(index, entry);
+}
+
+void TimerHeap::place(size_t index, const Entry& entry)
+{
+    mEntries[index] = entry;
+    entry.node->mHeapIndex = static_cast<uint32_t>(index);
+}
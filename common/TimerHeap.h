@@ -0,0 +1,106 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+class TimerHeap;
+
+/*
+ * Intrusive hook for TimerHeap.
+ *
+ * The node remembers its own slot in the heap, so remove() does not need
+ * to search for it. A node can be queued in at most one heap at a time.
+ *
+ * The kind tag lets the heap owner tell its node types apart without
+ * virtual calls. TimerHeap itself ignores it.
+ */
+class TimerHeapNode
+{
+public:
+    static constexpr uint32_t InvalidIndex = static_cast<uint32_t>(-1);
+
+    enum class Kind : uint8_t
+    {
+        Timer,      // Timer
+        Task,       // MainLoop::postDelayed()/postAt() entry
+        Callable,   // LoopTimer
+    };
+
+    explicit TimerHeapNode(Kind kind = Kind::Timer) : mKind(kind) { }
+
+    bool isQueued() const { return mHeapIndex != InvalidIndex; }
+    Kind getKind() const  { return mKind; }
+
+private:
+    friend class TimerHeap;
+
+    uint32_t mHeapIndex = InvalidIndex;  // 8-byte hook, for compact LoopTimers
+    Kind     mKind;
+};
+
+/*
+ * 4-ary min-heap ordered by expiry. Entries with the same expiry come out
+ * in push() order.
+ *
+ * - push()   : O(log n)
+ * - remove() : O(log n)
+ * - top()    : O(1)
+ * - pop()    : O(log n)
+ *
+ * The expiry and a push sequence number are copied into the heap entry at
+ * push() time so sifting does not have to dereference the nodes.
+ * Not thread-safe; the owner locks.
+ */
+class TimerHeap
+{
+public:
+    TimerHeap() = default;
+    ~TimerHeap();
+
+    TimerHeap(const TimerHeap&) = delete;
+    TimerHeap& operator=(const TimerHeap&) = delete;
+
+    bool push(TimerHeapNode* node, uint64_t expiry);
+    bool remove(TimerHeapNode* node);
+
+    TimerHeapNode* pop();
+
+    TimerHeapNode* top() const;
+    uint64_t       topExpiry() const;
+
+    bool   empty() const { return mEntries.empty(); }
+    size_t size() const  { return mEntries.size(); }
+
+private:
+    static constexpr size_t Arity = 4;
+
+    struct Entry
+    {
+        uint64_t       expiry;
+        uint64_t       seq;     // tiebreak for equal expiries, FIFO
+        TimerHeapNode* node;
+    };
+
+    static bool before(const Entry& a, const Entry& b)
+    {
+        return a.expiry < b.expiry || (a.expiry == b.expiry && a.seq < b.seq);
+    }
+
+    void removeAt(size_t index);
+
+    void siftUp(size_t index);
+    void siftDown(size_t index);
+
+    void place(size_t index, const Entry& entry);
+
+private:
+    std::vector<Entry> mEntries;
+    uint64_t           mNextSeq = 0;
+};
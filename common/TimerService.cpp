@@ -0,0 +1,411 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#include "TimerService.h"
+
+#include "SysTime.h"
+#include "Log.h"
+
+#include <chrono>
+
+namespace
+{
+constexpr uint64_t NsPerUs = 1000ULL;
+constexpr uint64_t NsPerMs = 1000ULL * 1000ULL;
+constexpr uint32_t Infinite = static_cast<uint32_t>(-1);
+
+/*
+ * Set on service threads: the service, and the timer whose handler runs.
+ */
+thread_local const TimerService* tService = nullptr;
+thread_local const ServiceTimer* tTimer = nullptr;
+
+/*
+ * SysTime ticks are steady_clock ticks.
+ */
+std::chrono::steady_clock::time_point toTimePoint(uint64_t ns)
+{
+    return std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(ns)));
+}
+}
+
+ServiceTimer::ServiceTimer(TimerService& service)
+    : mService(service)
+    , mHandler(nullptr)
+    , mIntervalNs(0)
+    , mExpiry(0)
+    , mState(State::Stopped)
+    , mRepeat(false)
+    , mInFlight(false)
+{
+}
+
+ServiceTimer::~ServiceTimer()
+{
+    stop();
+}
+
+void ServiceTimer::setHandler(ITimerHandler* handler)
+{
+    TimerService::Lock lock(mService.mLock);
+
+    /*
+     * The old handler may be destroyed once this returns.
+     */
+    mService.waitIdleLocked(lock, this);
+    mHandler = handler;
+}
+
+void ServiceTimer::start(uint32_t msec, bool repeat)
+{
+    if (msec == Infinite)
+    {
+        LOGE("ServiceTimer::start() ignored. interval is Infinite.");
+        return;
+    }
+
+    startNs(static_cast<uint64_t>(msec) * NsPerMs, repeat);
+}
+
+void ServiceTimer::startUs(uint32_t usec, bool repeat)
+{
+    if (usec == Infinite)
+    {
+        LOGE("ServiceTimer::startUs() ignored. interval is Infinite.");
+        return;
+    }
+
+    startNs(static_cast<uint64_t>(usec) * NsPerUs, repeat);
+}
+
+void ServiceTimer::startNs(uint64_t intervalNs, bool repeat)
+{
+    TimerService::Lock lock(mService.mLock);
+
+    mService.removeLocked(this);
+    mService.waitIdleLocked(lock, this);
+
+    /*
+     * Queued again while stop() waited.
+     */
+    mService.removeLocked(this);
+
+    mIntervalNs = intervalNs;
+    mRepeat = repeat;
+    mExpiry = SysTime::getTickCountNs() + intervalNs;
+
+    /*
+     * From its own handler: queued by the service once the handler
+     * returns, so it cannot fire on another thread meanwhile.
+     */
+    if (tTimer == this)
+    {
+        mState = State::Rearmed;
+        return;
+    }
+
+    mService.insertLocked(this);
+}
+
+void ServiceTimer::restart()
+{
+    uint64_t intervalNs = 0;
+    bool repeat = false;
+
+    {
+        TimerService::Lock lock(mService.mLock);
+
+        intervalNs = mIntervalNs;
+        repeat = mRepeat;
+    }
+
+    startNs(intervalNs, repeat);
+}
+
+void ServiceTimer::stop()
+{
+    TimerService::Lock lock(mService.mLock);
+
+    mService.removeLocked(this);
+    mService.waitIdleLocked(lock, this);
+}
+
+void ServiceTimer::setInterval(uint32_t msec)
+{
+    if (msec == Infinite)
+    {
+        LOGE("ServiceTimer::setInterval() ignored. interval is Infinite.");
+        return;
+    }
+
+    TimerService::Lock lock(mService.mLock);
+    mIntervalNs = static_cast<uint64_t>(msec) * NsPerMs;
+}
+
+void ServiceTimer::setIntervalUs(uint32_t usec)
+{
+    if (usec == Infinite)
+    {
+        LOGE("ServiceTimer::setIntervalUs() ignored. interval is Infinite.");
+        return;
+    }
+
+    TimerService::Lock lock(mService.mLock);
+    mIntervalNs = static_cast<uint64_t>(usec) * NsPerUs;
+}
+
+uint32_t ServiceTimer::getInterval() const
+{
+    TimerService::Lock lock(mService.mLock);
+    return static_cast<uint32_t>(mIntervalNs / NsPerMs);
+}
+
+uint32_t ServiceTimer::getIntervalUs() const
+{
+    TimerService::Lock lock(mService.mLock);
+    return static_cast<uint32_t>(mIntervalNs / NsPerUs);
+}
+
+void ServiceTimer::setRepeat(bool repeat)
+{
+    TimerService::Lock lock(mService.mLock);
+    mRepeat = repeat;
+}
+
+bool ServiceTimer::getRepeat() const
+{
+    TimerService::Lock lock(mService.mLock);
+    return mRepeat;
+}
+
+bool ServiceTimer::isRunning() const
+{
+    TimerService::Lock lock(mService.mLock);
+    return mState != State::Stopped;
+}
+
+TimerService::TimerService(size_t count, const std::string& name, int priority, int cpuid)
+    : mHasLeader(false)
+    , mIdleWaiters(0)
+{
+    if (count == 0)
+        count = 1;
+
+    mRunners.reserve(count);
+
+    for (size_t i = 0; i < count; ++i)
+        mRunners.emplace_back(new Runner(*this, name + std::to_string(i), priority, cpuid));
+}
+
+TimerService::~TimerService()
+{
+    stop();
+}
+
+bool TimerService::start()
+{
+    for (size_t i = 0; i < mRunners.size(); ++i)
+    {
+        if (!mRunners[i]->start())
+        {
+            LOGE("failed to start timer service thread %zu", i);
+            stop();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void TimerService::stop()
+{
+    for (std::unique_ptr<Runner>& runner : mRunners)
+        runner->stop();
+}
+
+ServiceTimer TimerService::createTimer()
+{
+    return ServiceTimer(*this);
+}
+
+size_t TimerService::getTimerCount() const
+{
+    Lock lock(mLock);
+    return mTimers.size();
+}
+
+bool TimerService::isServiceThread() const
+{
+    return tService == this;
+}
+
+void TimerService::wakeAll()
+{
+    /*
+     * Locked, so a thread between its shouldRun() check and its wait
+     * cannot miss this.
+     */
+    Lock lock(mLock);
+
+    mLeaderCv.notify_all();
+    mFollowerCv.notify_all();
+}
+
+void TimerService::insertLocked(ServiceTimer* timer)
+{
+    const bool earliest = timer->mExpiry < mTimers.topExpiry();
+
+    mTimers.push(timer, timer->mExpiry);
+    timer->mState = ServiceTimer::State::Queued;
+
+    if (!earliest)
+        return;
+
+    /*
+     * Without a leader every thread is busy or about to take the lead;
+     * all of them look at the heap before they wait again.
+     */
+    if (mHasLeader)
+        mLeaderCv.notify_one();
+    else
+        mFollowerCv.notify_one();
+}
+
+void TimerService::removeLocked(ServiceTimer* timer)
+{
+    if (timer->mState == ServiceTimer::State::Queued)
+        mTimers.remove(timer);
+
+    timer->mState = ServiceTimer::State::Stopped;
+}
+
+void TimerService::waitIdleLocked(Lock& lock, ServiceTimer* timer)
+{
+    /*
+     * Called from its own handler: the callback returns to the service,
+     * which sees the state was changed and leaves the timer alone.
+     */
+    if (tTimer == timer)
+        return;
+
+    if (!timer->mInFlight)
+        return;
+
+    mIdleWaiters++;
+    mIdle.wait(lock, [timer]() { return !timer->mInFlight; });
+    mIdleWaiters--;
+}
+
+uint64_t TimerService::getNextExpiry(uint64_t expiry, uint64_t intervalNs, uint64_t now)
+{
+    if (intervalNs == 0)
+        return now;
+
+    uint64_t next = expiry + intervalNs;
+
+    /*
+     * Fell behind: skip the ticks already past, stay on the grid.
+     */
+    if (next <= now)
+        next += ((now - next) / intervalNs + 1) * intervalNs;
+
+    return next;
+}
+
+void TimerService::run(Runner& runner)
+{
+    tService = this;
+
+    Lock lock(mLock);
+
+    while (runner.shouldRun())
+    {
+        if (mHasLeader)
+        {
+            mFollowerCv.wait(lock);
+            continue;
+        }
+
+        if (mTimers.empty())
+        {
+            mHasLeader = true;
+            mLeaderCv.wait(lock);
+            mHasLeader = false;
+            continue;
+        }
+
+        const uint64_t now = SysTime::getTickCountNs();
+        const uint64_t expiry = mTimers.topExpiry();
+
+        if (expiry > now)
+        {
+            mHasLeader = true;
+            mLeaderCv.wait_until(lock, toTimePoint(expiry));
+            mHasLeader = false;
+            continue;
+        }
+
+        ServiceTimer* timer = static_cast<ServiceTimer*>(mTimers.pop());
+
+        timer->mState = ServiceTimer::State::Executing;
+        timer->mInFlight = true;
+
+        /*
+         * Hand over the lead while this thread runs the handler.
+         */
+        if (!mTimers.empty())
+            mFollowerCv.notify_one();
+
+        ITimerHandler* handler = timer->mHandler;
+        bool keepGoing = timer->mRepeat;
+
+        lock.unlock();
+
+        if (handler)
+        {
+            tTimer = timer;
+            keepGoing &= handler->onTimerExpired(*timer);
+            tTimer = nullptr;
+        }
+
+        lock.lock();
+
+        timer->mInFlight = false;
+
+        /*
+         * Restarted by its own handler: queue it now.
+         * Not stopped or restarted meanwhile: requeue or stop.
+         * Repeat is read again, setRepeat() may have been called.
+         */
+        if (timer->mState == ServiceTimer::State::Rearmed)
+        {
+            insertLocked(timer);
+        }
+        else if (timer->mState == ServiceTimer::State::Executing)
+        {
+            if (keepGoing && timer->mRepeat)
+            {
+                timer->mExpiry = getNextExpiry(timer->mExpiry, timer->mIntervalNs, SysTime::getTickCountNs());
+                insertLocked(timer);
+            }
+            else
+            {
+                timer->mState = ServiceTimer::State::Stopped;
+            }
+        }
+
+        if (mIdleWaiters > 0)
+            mIdle.notify_all();
+    }
+
+    /*
+     * Let a follower take over the lead, if one is left.
+     */
+    mFollowerCv.notify_one();
+
+    tService = nullptr;
+}
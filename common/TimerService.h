@@ -0,0 +1,200 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include "Timer.h"
+#include "TimerHeap.h"
+#include "WorkerThread.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class TimerService;
+
+/*
+ * ITimer handle run by a TimerService. Created with
+ * TimerService::createTimer(); 56 bytes on LP64, no thread of its own.
+ *
+ * Repeating timers are fixed-rate: expiries stay on the
+ * start + n * interval grid, ticks that are already past are skipped.
+ *
+ * The handler is called on one of the service's threads, never on two
+ * at once for the same timer. Control calls are thread-safe; called
+ * from another thread, stop(), restart() and setHandler() wait for a
+ * callback in flight. From its own handler, a timer may be started,
+ * restarted or stopped; a (re)start is queued once the handler returns.
+ * Must be destroyed before its service.
+ */
+class ServiceTimer : public ITimer, private TimerHeapNode
+{
+public:
+    ~ServiceTimer() override;
+
+    ServiceTimer(const ServiceTimer&) = delete;
+    ServiceTimer& operator=(const ServiceTimer&) = delete;
+
+    void setHandler(ITimerHandler* handler) override;
+
+    void start(uint32_t msec, bool repeat) override;
+    void restart() override;
+    void stop() override;
+
+    void setInterval(uint32_t msec) override;
+    uint32_t getInterval() const override;
+
+    void setRepeat(bool repeat) override;
+    bool getRepeat() const override;
+
+    bool isRunning() const override;
+
+    /*
+     * Microsecond variants. The service sleeps with nanosecond
+     * resolution, so these are honored down to the scheduler's latency.
+     */
+    void startUs(uint32_t usec, bool repeat);
+
+    void setIntervalUs(uint32_t usec);
+    uint32_t getIntervalUs() const;
+
+private:
+    friend class TimerService;
+
+    explicit ServiceTimer(TimerService& service);
+
+    enum class State : uint8_t
+    {
+        Stopped,
+        Queued,
+        Executing,  // popped for a callback, not touched since
+        Rearmed,    // started from its own callback, queued after it
+    };
+
+    void startNs(uint64_t intervalNs, bool repeat);
+
+private:
+    /*
+     * Guarded by the service lock.
+     */
+    TimerService&  mService;
+    ITimerHandler* mHandler;
+    uint64_t       mIntervalNs;
+    uint64_t       mExpiry;
+    State          mState;
+    bool           mRepeat;
+    bool           mInFlight;   // handler running, see stop()
+};
+
+/*
+ * Runs many ServiceTimers on one or a few threads sharing one deadline
+ * heap, instead of a thread per TimerThread.
+ *
+ *   TimerService service(1, "Timers");
+ *   service.start();
+ *
+ *   ServiceTimer timer = service.createTimer();
+ *   timer.setHandler(&handler);
+ *   timer.start(100, true);
+ *
+ * Threads sleep on a condition variable until the earliest deadline
+ * (nanoseconds, CLOCK_MONOTONIC). With several threads, one leader waits
+ * for the deadline and the others wait untimed, so a deadline wakes one
+ * thread only; the leader hands over when it takes a timer.
+ */
+class TimerService
+{
+public:
+    /*
+     * count    : number of threads, at least 1.
+     * name     : thread name prefix. Threads are named "<name><index>".
+     * priority : WorkerThread priority (> 0 means SCHED_FIFO).
+     * cpuid    : pin all threads to this CPU, -1 for none.
+     */
+    explicit TimerService(size_t count = 1,
+                          const std::string& name = "TimerService",
+                          int priority = -1,
+                          int cpuid = -1);
+    ~TimerService();
+
+    TimerService(const TimerService&) = delete;
+    TimerService& operator=(const TimerService&) = delete;
+
+    /*
+     * Timers may be started before start(); they fire once it runs.
+     */
+    bool start();
+    void stop();
+
+    ServiceTimer createTimer();
+
+    size_t getTimerCount() const;
+
+    /*
+     * true on one of this service's threads.
+     */
+    bool isServiceThread() const;
+
+private:
+    friend class ServiceTimer;
+
+    class Runner : public IWorker
+    {
+    public:
+        Runner(TimerService& service, const std::string& name, int priority, int cpuid)
+            : mService(service)
+            , mThread(name, priority, cpuid)
+        {
+        }
+
+        bool start() { return mThread.start(*this); }
+        void stop()  { mThread.stop(); }
+
+        bool shouldRun() const { return mThread.shouldRun(); }
+
+    private:
+        void run() noexcept override { mService.run(*this); }
+        void onPreStop() override    { mService.wakeAll(); }
+
+    private:
+        TimerService& mService;
+        WorkerThread  mThread;
+    };
+
+    using Lock = std::unique_lock<std::mutex>;
+
+    void run(Runner& runner);
+    void wakeAll();
+
+    /*
+     * Called with mLock held.
+     */
+    void insertLocked(ServiceTimer* timer);
+    void removeLocked(ServiceTimer* timer);
+    void waitIdleLocked(Lock& lock, ServiceTimer* timer);
+
+    static uint64_t getNextExpiry(uint64_t expiry, uint64_t intervalNs, uint64_t now);
+
+private:
+    mutable std::mutex mLock;
+
+    TimerHeap mTimers;
+
+    /*
+     * Leader: the one thread waiting for the earliest deadline.
+     * Followers wait untimed. mIdle wakes stop() waiting for a callback.
+     */
+    std::condition_variable mLeaderCv;
+    std::condition_variable mFollowerCv;
+    std::condition_variable mIdle;
+    bool                    mHasLeader;
+    size_t                  mIdleWaiters;
+
+    std::vector<std::unique_ptr<Runner>> mRunners;
+};
@@ -6,19 +6,32 @@
  */
 #include "TimerThread.h"
 
+#include <algorithm>
 #include <errno.h>
+#include <time.h>
+#include <sys/prctl.h>
 #include "SysTime.h"
 #include "Log.h"
 
+namespace
+{
+constexpr uint64_t NsPerUs  = 1000ULL;
+constexpr uint64_t NsPerMs  = 1000ULL * NsPerUs;
+constexpr uint64_t NsPerSec = 1000ULL * NsPerMs;
+}
 
-using Lock = std::unique_lock<std::recursive_mutex>;
 
-TimerThread::TimerThread()
-          : mRepeat(false),
-            mStartTime(0),
-            mIntervalMs(0),
-            mHandler(nullptr),
-            mThread("TimerThread")
+TimerThread::TimerThread(const std::string& name, int priority, int cpuid)
+          : mHandler(nullptr),
+            mRepeat(false),
+            mPrecise(false),
+            mIntervalNs(0),
+            mExpiryNs(0),
+            mOverrunCount(0),
+            mRunThread(pthread_t()),
+            mInCallback(false),
+            mHandlerWaiters(0),
+            mThread(name, priority, cpuid)
 {
 }
 
@@ -29,21 +42,57 @@ TimerThread::~TimerThread()
 
 void TimerThread::setHandler(ITimerHandler* handler)
 {
-    Lock lock(mLock);
+    mHandler.store(handler);
+
+    /*
+     * Wait for a callback that may still use the old handler, so it can
+     * be destroyed once this returns. Not from the callback itself.
+     * Pairs with the store/load order in fire().
+     */
+    if (!mInCallback.load() || isInOwnCallback())
+        return;
 
-    mHandler = handler;
+    mHandlerWaiters.fetch_add(1);
+
+    {
+        std::unique_lock<std::mutex> lock(mWaitLock);
+        mCallbackDone.wait(lock, [this]() { return !mInCallback.load(); });
+    }
+
+    mHandlerWaiters.fetch_sub(1);
 }
 
 void TimerThread::start(uint32_t msec, bool repeat)
 {
+    startNs(static_cast<uint64_t>(msec) * NsPerMs, repeat);
+}
+
+void TimerThread::startUs(uint32_t usec, bool repeat)
+{
+    startNs(static_cast<uint64_t>(usec) * NsPerUs, repeat);
+}
+
+void TimerThread::startNs(uint64_t nsec, bool repeat)
+{
+    std::unique_lock<std::mutex> lock(mControlLock, std::defer_lock);
+
+    /*
+     * Not in the handler: a start() holding the lock on another thread
+     * may be joining this one. What is written here happens before that
+     * join returns.
+     */
+    if (!isInOwnCallback())
+        lock.lock();
+
     mThread.stop();
 
-    {
-        Lock lock(mLock);
-        mRepeat     = repeat;
-        mStartTime  = SysTime::getTickCountMs();
-        mIntervalMs = msec;
-    }
+    /*
+     * The thread is stopped: mExpiryNs is ours until it starts again.
+     */
+    mRepeat.store(repeat, std::memory_order_relaxed);
+    mIntervalNs.store(nsec, std::memory_order_relaxed);
+    mExpiryNs = SysTime::getTickCountNs() + nsec;
+    mOverrunCount.store(0, std::memory_order_relaxed);
 
     if (!mThread.start(*this))
     {
@@ -58,78 +107,228 @@ void TimerThread::stop()
 
 void TimerThread::setInterval(uint32_t msec)
 {
-    Lock lock(mLock);
-    mIntervalMs = msec;
+    mIntervalNs.store(static_cast<uint64_t>(msec) * NsPerMs, std::memory_order_relaxed);
 }
 
 void TimerThread::setRepeat(bool repeat)
 {
-    Lock lock(mLock);
-    mRepeat = repeat;
+    mRepeat.store(repeat, std::memory_order_relaxed);
 }
 
 uint32_t TimerThread::getInterval() const
 {
-    Lock lock(mLock);
-    return mIntervalMs;
+    return static_cast<uint32_t>(mIntervalNs.load(std::memory_order_relaxed) / NsPerMs);
+}
+
+uint64_t TimerThread::getIntervalNs() const
+{
+    return mIntervalNs.load(std::memory_order_relaxed);
+}
+
+void TimerThread::setPrecise(bool enable)
+{
+    mPrecise.store(enable, std::memory_order_relaxed);
+}
+
+bool TimerThread::isPrecise() const
+{
+    return mPrecise.load(std::memory_order_relaxed);
+}
+
+Histogram::Snapshot TimerThread::getJitter() const
+{
+    return mJitter.snapshot();
+}
+
+void TimerThread::resetJitter()
+{
+    mJitter.reset();
+}
+
+uint64_t TimerThread::getOverrunCount() const
+{
+    return mOverrunCount.load(std::memory_order_relaxed);
 }
 
 bool TimerThread::getRepeat() const
 {
-    Lock lock(mLock);
-    return mRepeat;
+    return mRepeat.load(std::memory_order_relaxed);
 }
 
 void TimerThread::restart()
 {
+    std::unique_lock<std::mutex> lock(mControlLock, std::defer_lock);
+
+    /*
+     * See startNs().
+     */
+    if (!isInOwnCallback())
+        lock.lock();
+
     mThread.stop();
+
+    mExpiryNs = SysTime::getTickCountNs() + mIntervalNs.load(std::memory_order_relaxed);
+    mOverrunCount.store(0, std::memory_order_relaxed);
+
+    mThread.start(*this);
+}
+
+void TimerThread::onPostStart() noexcept
+{
+    mRunThread.store(pthread_self(), std::memory_order_release);
+
+    /*
+     * The default 50us slack would be added to every precise sleep.
+     * 0 restores the default.
+     */
+    if (prctl(PR_SET_TIMERSLACK, isPrecise() ? 1UL : 0UL, 0, 0, 0) != 0)
     {
-        Lock lock(mLock);
-        mStartTime  = SysTime::getTickCountMs();
+        LOGW("cannot set timer slack. errno=%d", errno);
     }
-    mThread.start(*this);
+}
+
+bool TimerThread::isInOwnCallback() const
+{
+    /*
+     * A pthread_t may be reused once the thread exits; mInCallback is
+     * only set while the timer thread runs the handler.
+     */
+    return mInCallback.load() &&
+           pthread_equal(pthread_self(), mRunThread.load(std::memory_order_acquire)) != 0;
 }
 
 void TimerThread::run() noexcept
+{
+    if (isPrecise())
+        runPrecise();
+    else
+        runDefault();
+}
+
+void TimerThread::runDefault() noexcept
 {
     while (mThread.shouldRun())
     {
         int timeoutMs = 0;
+        const uint64_t expiryNs = mExpiryNs;
+
+        const int64_t currentTime = SysTime::getTickCountMs();
+        const int64_t expireTime  = static_cast<int64_t>((expiryNs + NsPerMs - 1) / NsPerMs);
+        const int64_t remainMs    = expireTime - currentTime;
+
+        if (remainMs <= 0)
         {
-            Lock lock(mLock);
-
-            const int64_t currentTime = SysTime::getTickCountMs();
-            const int64_t expireTime  = mStartTime + mIntervalMs;
-            const int64_t remainMs    = expireTime - currentTime;
-
-            if (remainMs <= 0)
-            {
-                LOGW("too short remainMs : %lld, change to 1ms", static_cast<long long>(remainMs));
-                timeoutMs = 1; // avoid busy waiting.
-            }
-            else if (remainMs > INT32_MAX)
-                timeoutMs = INT32_MAX;
-            else
-                timeoutMs = static_cast<int>(remainMs);
+            LOGW("too short remainMs : %lld, change to 1ms", static_cast<long long>(remainMs));
+            timeoutMs = 1; // avoid busy waiting.
         }
+        else if (remainMs > INT32_MAX)
+            timeoutMs = INT32_MAX;
+        else
+            timeoutMs = static_cast<int>(remainMs);
 
         mThread.msleep(timeoutMs);
 
+        const uint64_t now = SysTime::getTickCountNs();
+
+        if (now > expiryNs)
+            mJitter.record(now - expiryNs);
+        else
+            mJitter.record(0);
+
+        if (!mThread.shouldRun() || !fire())
+            break;
+
+        mExpiryNs += mIntervalNs.load(std::memory_order_relaxed);
+    }
+}
+
+bool TimerThread::sleepUntil(uint64_t expiryNs) noexcept
+{
+    while (mThread.shouldRun())
+    {
+        const uint64_t now = SysTime::getTickCountNs();
+
+        if (now >= expiryNs)
+            return true;
+
+        /*
+         * The last slice ends exactly at the expiry; an absolute target
+         * is not stretched by the time spent getting here.
+         */
+        const uint64_t target = std::min(expiryNs, now + static_cast<uint64_t>(PreciseSliceMs) * NsPerMs);
+
+        struct timespec ts;
+        ts.tv_sec  = static_cast<time_t>(target / NsPerSec);
+        ts.tv_nsec = static_cast<long>(target % NsPerSec);
+
+        int ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+        if (ret != 0 && ret != EINTR)
         {
-            Lock lock(mLock);
+            LOGE("clock_nanosleep failed. ret=%d", ret);
+            return false;
+        }
+    }
+
+    return false;
+}
+
+void TimerThread::runPrecise() noexcept
+{
+    while (mThread.shouldRun())
+    {
+        const uint64_t expiryNs = mExpiryNs;
+
+        if (!sleepUntil(expiryNs))
+            break;
+
+        mJitter.record(SysTime::getTickCountNs() - expiryNs);
+
+        if (!mThread.shouldRun() || !fire())
+            break;
 
-            if (!mThread.shouldRun())
-                break;
+        const uint64_t intervalNs = mIntervalNs.load(std::memory_order_relaxed);
 
-            bool keepGoing = mRepeat;
+        mExpiryNs += intervalNs;
 
-            if (mHandler)
-                keepGoing &= mHandler->onTimerExpired(*this);
+        /*
+         * Fell behind: skip the ticks already past and stay on the
+         * grid, instead of firing them back to back.
+         */
+        const uint64_t now = SysTime::getTickCountNs();
 
-            if (!keepGoing)
-                break;
+        if (intervalNs > 0 && mExpiryNs <= now)
+        {
+            const uint64_t missed = (now - mExpiryNs) / intervalNs + 1;
 
-            mStartTime += mIntervalMs;
+            mExpiryNs += missed * intervalNs;
+            mOverrunCount.fetch_add(missed, std::memory_order_relaxed);
         }
     }
 }
+
+bool TimerThread::fire() noexcept
+{
+    /*
+     * No lock held: getters and setters never wait for a callback.
+     * mInCallback is set before the handler is read, so setHandler(),
+     * which stores before it checks mInCallback, either sees the flag
+     * or has its handler picked up here (both sequentially consistent).
+     */
+    mInCallback.store(true);
+
+    ITimerHandler* handler = mHandler.load();
+    bool keepGoing = mRepeat.load(std::memory_order_relaxed);
+
+    if (handler)
+        keepGoing &= handler->onTimerExpired(*this);
+
+    mInCallback.store(false);
+
+    if (mHandlerWaiters.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(mWaitLock);
+        mCallbackDone.notify_all();
+    }
+
+    return keepGoing;
+}
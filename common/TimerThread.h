@@ -7,12 +7,35 @@
 #pragma once
 
 #include "Timer.h"
+#include "Histogram.h"
 #include "WorkerThread.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include <pthread.h>
+
+/*
+ * ITimer on a thread of its own.
+ *
+ * The handler is called on the timer thread with no lock held; the
+ * configuration is kept in atomics, so getters and setters from other
+ * threads never wait for a callback. setHandler() from another thread
+ * waits for a callback in flight, so the old handler may be destroyed
+ * once it returns.
+ */
 class TimerThread : public ITimer, IWorker
 {
 public:
-    TimerThread();
+    /*
+     * name     : thread name.
+     * priority : WorkerThread priority (> 0 means SCHED_FIFO), for
+     *            precise mode. Needs CAP_SYS_NICE or an RLIMIT_RTPRIO.
+     * cpuid    : pin the thread to this CPU, -1 for none.
+     */
+    TimerThread(const std::string& name = "TimerThread", int priority = -1, int cpuid = -1);
     ~TimerThread();
 
     void     setHandler(ITimerHandler* handler) override;
@@ -29,18 +52,98 @@ public:
 
     bool     isRunning() const override;
 
+    /*
+     * Microsecond/nanosecond periods. Sub-millisecond periods need
+     * precise mode.
+     */
+    void     startUs(uint32_t usec, bool repeat);
+    void     startNs(uint64_t nsec, bool repeat);
+
+    uint64_t getIntervalNs() const;
+
+    /*
+     * Precise mode: sleeps with clock_nanosleep(TIMER_ABSTIME) on
+     * CLOCK_MONOTONIC to each expiry of the start + n * interval grid,
+     * with the thread's timer slack at 1 ns, so wake-up error does not
+     * accumulate. Ticks already past are skipped and counted, see
+     * getOverrunCount(). Long sleeps are cut in PreciseSliceMs slices so
+     * stop() is noticed.
+     *
+     * Default mode: millisecond WorkerThread::msleep().
+     *
+     * Takes effect at the next start()/restart().
+     */
+    static constexpr uint32_t PreciseSliceMs = 20;
+
+    void     setPrecise(bool enable);
+    bool     isPrecise() const;
+
+    /*
+     * Wake-up lateness per expiry in nanoseconds: time the thread woke
+     * minus the expiry. Safe to call from any thread.
+     */
+    Histogram::Snapshot getJitter() const;
+    void     resetJitter();
+
+    /*
+     * Precise mode: ticks skipped because the thread fell behind.
+     */
+    uint64_t getOverrunCount() const;
+
 private:
-    ITimerHandler*  mHandler;
+    /*
+     * Configuration. Each field is read on its own, so plain atomics do;
+     * getters and setters never wait for a callback.
+     */
+    std::atomic<ITimerHandler*> mHandler;
+    std::atomic<bool>           mRepeat;
+    std::atomic<bool>           mPrecise;
+    std::atomic<uint64_t>       mIntervalNs;
+
+    /*
+     * Timer thread only, or written while the thread is stopped under
+     * mControlLock, so two start()/restart() calls do not interleave.
+     */
+    std::mutex mControlLock;
+    uint64_t   mExpiryNs;
+
+    std::atomic<uint64_t> mOverrunCount;
+
+    Histogram mJitter;
 
-    bool     mRepeat;
-    uint64_t mStartTime;
-    int      mIntervalMs;
+    /*
+     * Callback tracking for setHandler(), see fire(). mRunThread is set
+     * by the timer thread and read by others.
+     */
+    std::atomic<pthread_t>  mRunThread;
+    std::atomic<bool>       mInCallback;
+    std::atomic<uint32_t>   mHandlerWaiters;
+    std::mutex              mWaitLock;
+    std::condition_variable mCallbackDone;
 
 private:
     void     run() noexcept override;
+    void     onPostStart() noexcept override;
+
+    /*
+     * true in the handler, on the timer thread.
+     */
+    bool     isInOwnCallback() const;
+
+    void     runDefault() noexcept;
+    void     runPrecise() noexcept;
+
+    /*
+     * @return false if the thread is stopping.
+     */
+    bool     sleepUntil(uint64_t expiryNs) noexcept;
+
+    /*
+     * Calls the handler. @return false to stop.
+     */
+    bool     fire() noexcept;
 
 private:
-    mutable std::recursive_mutex mLock;
     WorkerThread mThread;
 };
 
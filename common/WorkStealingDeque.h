@@ -0,0 +1,198 @@
+/**
+ * My simple base code
+ * for developing embedded system.
+ *
+ * author: Kyungin.Kim < myohancat@naver.com >
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Chase-Lev work-stealing deque of pointers.
+ * (Le, Pop, Cohen, Nardelli: "Correct and Efficient Work-Stealing for
+ *  Weak Memory Models", PPoPP 2013)
+ *
+ * - push() / take() : owner thread only, LIFO end. No atomic RMW unless
+ *                     the deque is down to its last item.
+ * - steal()         : any thread, FIFO end. One CAS.
+ *
+ * The ring grows by doubling. Old rings are kept until destruction, as
+ * a thief may still be reading one; together less than the final one.
+ * The deque never owns the items.
+ */
+template <typename T>
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(size_t capacity = 256)
+        : mTop(0)
+        , mBottom(0)
+    {
+        size_t size = 1;
+
+        while (size < capacity)
+            size <<= 1;
+
+        mRing.store(newRing(size), std::memory_order_relaxed);
+    }
+
+    ~WorkStealingDeque()
+    {
+        for (Ring* ring : mRings)
+            delete ring;
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    void push(T* item)
+    {
+        const int64_t bottom = mBottom.load(std::memory_order_relaxed);
+        const int64_t top = mTop.load(std::memory_order_acquire);
+
+        Ring* ring = mRing.load(std::memory_order_relaxed);
+
+        if (bottom - top > static_cast<int64_t>(ring->mask))
+            ring = grow(ring, top, bottom);
+
+        ring->put(bottom, item);
+
+        /*
+         * Release store rather than the paper's fence + relaxed store:
+         * same cost on x86, and visible to ThreadSanitizer.
+         */
+        mBottom.store(bottom + 1, std::memory_order_release);
+    }
+
+    /*
+     * @return nullptr if empty, or the last item was stolen meanwhile.
+     */
+    T* take()
+    {
+        const int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+        Ring* ring = mRing.load(std::memory_order_relaxed);
+
+        mBottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        int64_t top = mTop.load(std::memory_order_relaxed);
+
+        if (top > bottom)
+        {
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T* item = ring->get(bottom);
+
+        if (top == bottom)
+        {
+            /*
+             * Last item: race the thieves for it.
+             */
+            if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed))
+            {
+                item = nullptr;
+            }
+
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        return item;
+    }
+
+    /*
+     * @return nullptr if empty, or another thread won the item.
+     */
+    T* steal()
+    {
+        int64_t top = mTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = mBottom.load(std::memory_order_acquire);
+
+        if (top >= bottom)
+            return nullptr;
+
+        Ring* ring = mRing.load(std::memory_order_acquire);
+        T* item = ring->get(top);
+
+        if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+
+        return item;
+    }
+
+    /*
+     * Approximate when called from a thief.
+     */
+    bool empty() const
+    {
+        const int64_t bottom = mBottom.load(std::memory_order_relaxed);
+        const int64_t top = mTop.load(std::memory_order_relaxed);
+
+        return bottom <= top;
+    }
+
+private:
+    struct Ring
+    {
+        explicit Ring(size_t size)
+            : mask(size - 1)
+            , items(size)
+        {
+        }
+
+        T* get(int64_t index) const
+        {
+            return items[static_cast<size_t>(index) & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t index, T* item)
+        {
+            items[static_cast<size_t>(index) & mask].store(item, std::memory_order_relaxed);
+        }
+
+        size_t                      mask;
+        std::vector<std::atomic<T*>> items;
+    };
+
+    Ring* newRing(size_t size)
+    {
+        Ring* ring = new Ring(size);
+
+        mRings.push_back(ring);
+        return ring;
+    }
+
+    Ring* grow(Ring* ring, int64_t top, int64_t bottom)
+    {
+        Ring* bigger = newRing((ring->mask + 1) * 2);
+
+        for (int64_t i = top; i < bottom; ++i)
+            bigger->put(i, ring->get(i));
+
+        mRing.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+private:
+    /*
+     * Thieves hammer mTop, the owner mBottom: keep them apart.
+     */
+    alignas(64) std::atomic<int64_t> mTop;
+    alignas(64) std::atomic<int64_t> mBottom;
+    alignas(64) std::atomic<Ring*>   mRing;
+
+    /*
+     * Owner thread only.
+     */
+    std::vector<Ring*> mRings;
+};